@@ -0,0 +1,185 @@
+#define LUA_LIB
+
+#include "skynet.h"
+#include "skynet_capture.h"
+#include "skynet_socket.h"
+#include "skynet_readbuffer.h"
+
+#include <lua.h>
+#include <lauxlib.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Read the binary capture file (see skynet_capture.h) for replay.
+
+struct capture {
+	struct skynet_capture_header header;
+	char *ring;
+	uint64_t pos;
+	const struct skynet_capture_record *current;
+	int truncated;	// records skipped because the payload is truncated
+};
+
+static int
+lclose(lua_State *L) {
+	struct capture *c = luaL_checkudata(L, 1, "SKYNET_CAPTURE");
+	skynet_free(c->ring);
+	c->ring = NULL;
+	c->current = NULL;
+	return 0;
+}
+
+static const struct skynet_capture_record *
+next_record(struct capture *c) {
+	uint64_t cap = c->header.capacity;
+	while (c->pos < c->header.head) {
+		uint64_t offset = c->pos % cap;
+		uint64_t rest = cap - offset;
+		const struct skynet_capture_record *rec = (const struct skynet_capture_record *)(c->ring + offset);
+		if (rest < sizeof(*rec) || rec->size == SKYNET_CAPTURE_WRAP) {
+			c->pos += rest;
+			continue;
+		}
+		uint64_t sz = skynet_capture_recordsize(rec->size);
+		if (sz > rest) {
+			// corrupted
+			c->pos = c->header.head;
+			return NULL;
+		}
+		c->pos += sz;
+		if (rec->size < rec->sz) {
+			++c->truncated;
+			continue;
+		}
+		return rec;
+	}
+	return NULL;
+}
+
+// returns time (microsec since open), source, type, session, size ; or nil at the end
+static int
+lnext(lua_State *L) {
+	struct capture *c = luaL_checkudata(L, 1, "SKYNET_CAPTURE");
+	if (c->ring == NULL) {
+		return luaL_error(L, "capture is closed");
+	}
+	const struct skynet_capture_record *rec = next_record(c);
+	c->current = rec;
+	if (rec == NULL) {
+		return 0;
+	}
+	lua_pushinteger(L, (lua_Integer)(rec->time - c->header.open_time));
+	lua_pushinteger(L, rec->source);
+	lua_pushinteger(L, rec->type);
+	lua_pushinteger(L, rec->session);
+	lua_pushinteger(L, rec->sz);
+	return 5;
+}
+
+// A new copy of the current message for skynet.redirect : msg (lightuserdata), sz
+static int
+lmessage(lua_State *L) {
+	struct capture *c = luaL_checkudata(L, 1, "SKYNET_CAPTURE");
+	const struct skynet_capture_record *rec = c->current;
+	if (rec == NULL) {
+		return luaL_error(L, "no current message");
+	}
+	const char *payload = (const char *)(rec + 1);
+	size_t size = rec->size;
+	if (rec->type == PTYPE_SOCKET && size >= sizeof(struct skynet_capture_socket)) {
+		const struct skynet_capture_socket *s = (const struct skynet_capture_socket *)payload;
+		payload += sizeof(*s);
+		size -= sizeof(*s);
+		struct skynet_socket_message *sm;
+		size_t sz = sizeof(*sm);
+		if (s->type == SKYNET_SOCKET_TYPE_DATA || s->type == SKYNET_SOCKET_TYPE_UDP) {
+			sm = skynet_malloc(sz);
+			sm->buffer = skynet_readbuffer_alloc(size);
+			memcpy(sm->buffer, payload, size);
+		} else {
+			// the string is after the message
+			sz += size;
+			sm = skynet_malloc(sz);
+			sm->buffer = NULL;
+			memcpy(sm + 1, payload, size);
+		}
+		sm->type = s->type;
+		sm->id = s->id;
+		sm->ud = s->ud;
+		lua_pushlightuserdata(L, sm);
+		lua_pushinteger(L, (lua_Integer)sz);
+		return 2;
+	}
+	void *msg = skynet_malloc(size);
+	memcpy(msg, payload, size);
+	lua_pushlightuserdata(L, msg);
+	lua_pushinteger(L, (lua_Integer)size);
+	return 2;
+}
+
+// returns handle, records skipped because of truncated
+static int
+linfo(lua_State *L) {
+	struct capture *c = luaL_checkudata(L, 1, "SKYNET_CAPTURE");
+	lua_pushinteger(L, c->header.handle);
+	lua_pushinteger(L, c->truncated);
+	return 2;
+}
+
+static int
+lopen(lua_State *L) {
+	const char *filename = luaL_checkstring(L, 1);
+	FILE *f = fopen(filename, "rb");
+	if (f == NULL) {
+		return luaL_error(L, "Can't open %s", filename);
+	}
+	char header[SKYNET_CAPTURE_HEADER];
+	const struct skynet_capture_header *h = (const struct skynet_capture_header *)header;
+	if (fread(header, sizeof(header), 1, f) != 1 || memcmp(h->magic, SKYNET_CAPTURE_MAGIC, sizeof(h->magic)) != 0) {
+		fclose(f);
+		return luaL_error(L, "%s is not a capture file", filename);
+	}
+	char *ring = skynet_malloc(h->capacity);
+	if (fread(ring, h->capacity, 1, f) != 1) {
+		skynet_free(ring);
+		fclose(f);
+		return luaL_error(L, "%s is truncated", filename);
+	}
+	fclose(f);
+	struct capture *c = lua_newuserdatauv(L, sizeof(*c), 0);
+	c->header = *h;
+	c->ring = ring;
+	c->pos = h->tail;
+	c->current = NULL;
+	c->truncated = 0;
+	luaL_setmetatable(L, "SKYNET_CAPTURE");
+	return 1;
+}
+
+LUAMOD_API int
+luaopen_skynet_capture(lua_State *L) {
+	luaL_checkversion(L);
+	luaL_Reg m[] = {
+		{ "next", lnext },
+		{ "message", lmessage },
+		{ "info", linfo },
+		{ "close", lclose },
+		{ NULL, NULL },
+	};
+	if (luaL_newmetatable(L, "SKYNET_CAPTURE")) {
+		luaL_newlib(L, m);
+		lua_setfield(L, -2, "__index");
+		lua_pushcfunction(L, lclose);
+		lua_setfield(L, -2, "__gc");
+	}
+	lua_pop(L, 1);
+
+	luaL_Reg l[] = {
+		{ "open", lopen },
+		{ NULL, NULL },
+	};
+	luaL_newlib(L, l);
+	return 1;
+}
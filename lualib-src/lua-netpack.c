@@ -1,6 +1,7 @@
 #define LUA_LIB
 
 #include "skynet_malloc.h"
+#include "skynet_readbuffer.h"
 
 #include "skynet_socket.h"
 
@@ -310,9 +311,9 @@ filter_data_(lua_State *L, int fd, uint8_t * buffer, int size) {
 static inline int
 filter_data(lua_State *L, int fd, uint8_t * buffer, int size) {
 	int ret = filter_data_(L, fd, buffer, size);
-	// buffer is the data of socket message, it malloc at socket_server.c : function forward_message .
+	// buffer is the data of socket message, it's allocated by socket_server.c : function forward_message_tcp .
 	// it should be free before return,
-	skynet_free(buffer);
+	skynet_readbuffer_free(buffer);
 	return ret;
 }
 
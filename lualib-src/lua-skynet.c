@@ -135,6 +135,8 @@ lcallback(lua_State *L) {
 	lua_xmove(L, cb_ctx->L, 1);
 
 	skynet_callback(context, cb_ctx, (forward)?(_forward_pre):(_cb_pre));
+	// the message is freed after _cb returns, so it can be stored in the message queue
+	skynet_callback_inline(context, !forward);
 	return 0;
 }
 
@@ -291,8 +293,8 @@ send_message(lua_State *L, int source, int idx_type) {
 		luaL_error(L, "invalid param %s", lua_typename(L, lua_type(L,idx_type+2)));
 	}
 	if (session < 0) {
-		if (session == -2) {
-			// package is too large
+		if (session == -2 || session == -3) {
+			// package is too large, or the mailbox of dest is full
 			lua_pushboolean(L, 0);
 			return 1;
 		}
@@ -318,6 +320,96 @@ lsend(lua_State *L) {
 	return send_message(L, 0, 2);
 }
 
+#define SENDV_BATCH 64
+
+/*
+	table addresses (array of uint32 address)
+	uint32 source (0 for self)
+	integer type
+	integer session
+	string message
+	 lightuserdata message_ptr
+	 integer len
+	return the number of messages sent
+ */
+static int
+lsendv(lua_State *L) {
+	struct skynet_context * context = lua_touserdata(L, lua_upvalueindex(1));
+	luaL_checktype(L, 1, LUA_TTABLE);
+	uint32_t source = (uint32_t)luaL_checkinteger(L, 2);
+	int type = luaL_checkinteger(L, 3);
+	int session = luaL_checkinteger(L, 4);
+	int n = lua_rawlen(L, 1);
+	int i;
+	void * msg = NULL;
+	size_t sz = 0;
+	int mtype = lua_type(L, 5);
+	switch (mtype) {
+	case LUA_TSTRING:
+		msg = (void *)lua_tolstring(L, 5, &sz);
+		if (sz == 0) {
+			msg = NULL;
+		}
+		break;
+	case LUA_TLIGHTUSERDATA:
+		msg = lua_touserdata(L, 5);
+		if (!lua_isinteger(L, 6)) {
+			skynet_free(msg);
+			return luaL_error(L, "Invalid message size");
+		}
+		sz = (size_t)lua_tointeger(L, 6);
+		// each destination owns a copy, the last one takes msg
+		type |= PTYPE_TAG_DONTCOPY;
+		break;
+	default:
+		return luaL_error(L, "invalid param %s", lua_typename(L, mtype));
+	}
+	for (i=1;i<=n;i++) {
+		lua_rawgeti(L, 1, i);
+		uint32_t dest = (uint32_t)lua_tointeger(L, -1);
+		lua_pop(L, 1);
+		if (dest == 0) {
+			if (mtype == LUA_TLIGHTUSERDATA) {
+				skynet_free(msg);
+			}
+			return luaL_error(L, "Invalid service address at %d", i);
+		}
+	}
+	if (n == 0) {
+		if (mtype == LUA_TLIGHTUSERDATA) {
+			skynet_free(msg);
+		}
+		lua_pushinteger(L, 0);
+		return 1;
+	}
+	struct skynet_batch batch[SENDV_BATCH];
+	int sent = 0;
+	int m = 0;
+	for (i=1;i<=n;i++) {
+		lua_rawgeti(L, 1, i);
+		struct skynet_batch *b = &batch[m];
+		b->destination = (uint32_t)lua_tointeger(L, -1);
+		lua_pop(L, 1);
+		b->session = session;
+		b->sz = sz;
+		if (mtype == LUA_TLIGHTUSERDATA && i < n) {
+			b->msg = skynet_malloc(sz);
+			memcpy(b->msg, msg, sz);
+		} else {
+			b->msg = msg;
+		}
+		if (++m == SENDV_BATCH) {
+			sent += skynet_send_batch(context, source, type, batch, m);
+			m = 0;
+		}
+	}
+	if (m > 0) {
+		sent += skynet_send_batch(context, source, type, batch, m);
+	}
+	lua_pushinteger(L, sent);
+	return 1;
+}
+
 /*
 	uint32 address
 	 string address
@@ -415,6 +507,12 @@ ltrash(lua_State *L) {
 	return 0;
 }
 
+static int
+lnameversion(lua_State *L) {
+	lua_pushinteger(L, skynet_nameversion());
+	return 1;
+}
+
 static int
 lnow(lua_State *L) {
 	uint64_t ti = skynet_now();
@@ -501,6 +599,7 @@ luaopen_skynet_core(lua_State *L) {
 
 	luaL_Reg l[] = {
 		{ "send" , lsend },
+		{ "sendv" , lsendv },
 		{ "genid", lgenid },
 		{ "redirect", lredirect },
 		{ "command" , lcommand },
@@ -522,6 +621,7 @@ luaopen_skynet_core(lua_State *L) {
 		{ "trash" , ltrash },
 		{ "now", lnow },
 		{ "hpc", lhpc },	// getHPCounter
+		{ "nameversion", lnameversion },
 		{ NULL, NULL },
 	};
 
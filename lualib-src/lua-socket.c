@@ -1,6 +1,7 @@
 #define LUA_LIB
 
 #include "skynet_malloc.h"
+#include "skynet_readbuffer.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -47,7 +48,7 @@ lfreepool(lua_State *L) {
 	for (i=0;i<sz;i++) {
 		struct buffer_node *node = &pool[i];
 		if (node->msg) {
-			skynet_free(node->msg);
+			skynet_readbuffer_free(node->msg);
 			node->msg = NULL;
 		}
 	}
@@ -164,7 +165,7 @@ return_free_node(lua_State *L, int pool, struct socket_buffer *sb) {
 	lua_rawgeti(L,pool,1);
 	free_node->next = lua_touserdata(L,-1);
 	lua_pop(L,1);
-	skynet_free(free_node->msg);
+	skynet_readbuffer_free(free_node->msg);
 	free_node->msg = NULL;
 
 	free_node->sz = 0;
@@ -301,7 +302,7 @@ static int
 ldrop(lua_State *L) {
 	void * msg = lua_touserdata(L,1);
 	luaL_checkinteger(L,2);
-	skynet_free(msg);
+	skynet_readbuffer_free(msg);
 	return 0;
 }
 
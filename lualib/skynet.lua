@@ -99,7 +99,7 @@ do ---- avoid session rewind conflict
 
 	-- in dangerzone, we should check if the next session already exist.
 	local function checkconflict(session)
-		if session == nil then
+		if not session then
 			return
 		end
 		local next_session = session + 1
@@ -190,6 +190,16 @@ do ---- avoid session rewind conflict
 	set_checkrewind()
 end
 
+-- forget the session of a timer, remove the timer if it's still in the timer wheel
+local function cancel_session(session)
+	if c.intcommand("CANCELTIMEOUT", session) == 1 then
+		session_id_coroutine[session] = nil
+	else
+		-- the response is in the message queue, or it's not a timer
+		session_id_coroutine[session] = "BREAK"
+	end
+end
+
 do ---- request/select
 	local function send_requests(self)
 		local sessions = {}
@@ -296,7 +306,7 @@ do ---- request/select
 			self._request = 0
 		end
 		if self._timeout then
-			session_id_coroutine[self._timeout] = "BREAK"
+			cancel_session(self._timeout)
 			self._timeout = nil
 		end
 	end
@@ -420,7 +430,7 @@ local function dispatch_wakeup()
 				local co = session_id_coroutine[session]
 				local tag = session_coroutine_tracetag[co]
 				if tag then c.trace(tag, "resume") end
-				session_id_coroutine[session] = "BREAK"
+				cancel_session(session)
 				return suspend(co, coroutine_resume(co, false, "BREAK", nil, session))
 			end
 		else
@@ -470,36 +480,62 @@ end
 
 local co_create_for_timeout
 local timeout_traceback
+-- skynet.canceltimeout resumes the timer coroutine with it, the coroutine goes back to the pool without calling func
+local TIMEOUT_CANCEL = {}
 
 function skynet.trace_timeout(on)
 	local function trace_coroutine(func, ti)
 		local co
-		co = co_create(function()
+		co = co_create(function(cancel)
 			timeout_traceback[co] = nil
-			func()
+			if cancel ~= TIMEOUT_CANCEL then
+				func()
+			end
 		end)
-		local info = string.format("TIMER %d+%d : ", skynet.now(), ti)
+		local info = string.format("TIMER %d+%s : ", skynet.now(), ti)
 		timeout_traceback[co] = traceback(info, 3)
 		return co
 	end
+	local function timeout_coroutine(func)
+		return co_create(function(cancel)
+			if cancel ~= TIMEOUT_CANCEL then
+				func()
+			end
+		end)
+	end
 	if on then
 		timeout_traceback = timeout_traceback or {}
 		co_create_for_timeout = trace_coroutine
 	else
 		timeout_traceback = nil
-		co_create_for_timeout = co_create
+		co_create_for_timeout = timeout_coroutine
 	end
 end
 
 skynet.trace_timeout(false)	-- turn off by default
 
+-- returns the coroutine (for debug) and the session for skynet.canceltimeout
 function skynet.timeout(ti, func)
 	local session = auxtimeout(ti)
 	assert(session)
 	local co = co_create_for_timeout(func, ti)
 	assert(session_id_coroutine[session] == nil)
 	session_id_coroutine[session] = co
-	return co	-- for debug
+	return co, session
+end
+
+-- cancel the timer created by skynet.timeout, returns true if the func will not be called
+function skynet.canceltimeout(session)
+	local co = session_id_coroutine[session]
+	if co == nil or co == "BREAK" then
+		return false
+	end
+	cancel_session(session)
+	-- run the coroutine to the end, it recycles itself
+	local running = running_thread
+	coroutine_resume(co, TIMEOUT_CANCEL)
+	running_thread = running
+	return true
 end
 
 local function suspend_sleep(session, token)
@@ -532,6 +568,16 @@ function skynet.yield()
 	return skynet.sleep(0)
 end
 
+-- like skynet.timeout and skynet.sleep, but ms is in millisecond.
+-- The precision is 10ms unless timer_precision = 1 in config. A fraction of ms is rounded up.
+function skynet.timeoutms(ms, func)
+	return skynet.timeout(math.ceil(ms) .. "ms", func)
+end
+
+function skynet.sleepms(ms, token)
+	return skynet.sleep(math.ceil(ms) .. "ms", token)
+end
+
 function skynet.wait(token)
 	local session = auxwait()
 	token = token or coroutine.running()
@@ -606,6 +652,31 @@ function skynet.localname(name)
 	return c.addresscommand("QUERY", name)
 end
 
+-- Cache the handle of a local name, so repeated sends to the name skip the lookup.
+-- The cache is dropped when any named service exits (the name version changes), so a cached handle
+-- is never of a service that left its name.
+local resolved_name = {}
+local resolved_version = c.nameversion()
+
+function skynet.resolvename(name)
+	local version = c.nameversion()
+	if version ~= resolved_version then
+		resolved_name = {}
+		resolved_version = version
+	end
+	local handle = resolved_name[name]
+	if handle == nil then
+		handle = skynet.localname(name)
+		resolved_name[name] = handle
+	end
+	return handle
+end
+
+-- Drop the cached handle of skynet.resolvename.
+function skynet.forgetname(name)
+	resolved_name[name] = nil
+end
+
 skynet.now = c.now
 skynet.hpc = c.hpc	-- high performance counter
 
@@ -700,12 +771,22 @@ function skynet.rawsend(addr, typename, msg, sz)
 	return c.send(addr, p.id, 0 , msg, sz)
 end
 
+-- send the same message to an array of addresses, returns the number of messages sent
+function skynet.sendv(addrs, typename, ...)
+	local p = proto[typename]
+	return c.sendv(addrs, 0, p.id, 0, p.pack(...))
+end
+
 skynet.genid = assert(c.genid)
 
 skynet.redirect = function(dest,source,typename,...)
 	return c.redirect(dest, source, proto[typename].id, ...)
 end
 
+skynet.redirectv = function(dests,source,typename,...)
+	return c.sendv(dests, source, proto[typename].id, ...)
+end
+
 skynet.pack = assert(c.pack)
 skynet.packstring = assert(c.packstring)
 skynet.unpack = assert(c.unpack)
@@ -734,6 +815,8 @@ function skynet.call(addr, typename, ...)
 	local session = auxsend(addr, p.id , p.pack(...))
 	if session == nil then
 		error("call to invalid address " .. skynet.address(addr))
+	elseif session == false then
+		error("call to " .. skynet.address(addr) .. " failed, the mailbox is full or the message is too large")
 	end
 	return p.unpack(yield_call(addr, session))
 end
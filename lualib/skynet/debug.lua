@@ -41,6 +41,17 @@ local function init(skynet, export)
 			stat.mqlen = skynet.stat "mqlen"
 			stat.cpu = skynet.stat "cpu"
 			stat.message = skynet.stat "message"
+			stat.budget = skynet.stat "budget"
+			local dropped = skynet.stat "dropped"
+			if dropped > 0 then
+				stat.dropped = dropped
+			end
+			if skynet.stat "wait_count" > 0 then
+				stat.wait = string.format("p50:%g p99:%g p999:%g max:%g",
+					skynet.stat "wait_p50", skynet.stat "wait_p99", skynet.stat "wait_p999", skynet.stat "wait_max")
+				stat.dispatch = string.format("p50:%g p99:%g p999:%g max:%g",
+					skynet.stat "dispatch_p50", skynet.stat "dispatch_p99", skynet.stat "dispatch_p999", skynet.stat "dispatch_max")
+			end
 			skynet.ret(skynet.pack(stat))
 		end
 
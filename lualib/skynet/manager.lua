@@ -29,6 +29,28 @@ function skynet.kill(name)
 	c.command("KILL",name)
 end
 
+-- class is "high", "normal" or "low", returns the current class
+function skynet.priority(class, addr)
+	if addr then
+		return c.command("PRIORITY", skynet.address(addr) .. " " .. (class or ""))
+	else
+		return c.command("PRIORITY", class or "")
+	end
+end
+
+-- set the mailbox capacity of current service, 0 means unlimited. policy is "reject" (default) or "drop".
+-- When the mailbox is full, skynet.send to it returns false and skynet.call raises an error,
+-- or the message sent by skynet.send is dropped silently for "drop" policy. The responses are never dropped,
+-- and the sockets of this service stop reading until the mailbox drains to half.
+-- returns the current capacity
+function skynet.capacity(n, policy)
+	if n then
+		return tonumber(c.command("CAPACITY", tostring(n) .. " " .. (policy or "")))
+	else
+		return tonumber(c.command("CAPACITY", ""))
+	end
+end
+
 function skynet.abort()
 	c.command("ABORT")
 end
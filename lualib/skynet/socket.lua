@@ -1,6 +1,5 @@
 local driver = require "skynet.socketdriver"
 local skynet = require "skynet"
-local skynet_core = require "skynet.core"
 local assert = assert
 
 local BUFFER_LIMIT = 128 * 1024
@@ -178,7 +177,7 @@ socket_message[6] = function(id, size, data, address)
 		return
 	end
 	local str = skynet.tostring(data, size)
-	skynet_core.trash(data, size)
+	driver.drop(data, size)
 	s.callback(str, address)
 end
 
@@ -1,6 +1,8 @@
 #ifndef skynet_databuffer_h
 #define skynet_databuffer_h
 
+#include "skynet_readbuffer.h"
+
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
@@ -55,7 +57,7 @@ _return_message(struct databuffer *db, struct messagepool *mp) {
 	} else {
 		db->head = m->next;
 	}
-	skynet_free(m->buffer);
+	skynet_readbuffer_free(m->buffer);
 	m->buffer = NULL;
 	m->size = 0;
 	m->next = mp->freelist;
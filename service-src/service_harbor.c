@@ -1,6 +1,7 @@
 #include "skynet.h"
 #include "skynet_harbor.h"
 #include "skynet_socket.h"
+#include "skynet_readbuffer.h"
 #include "skynet_handle.h"
 
 /*
@@ -682,7 +683,7 @@ mainloop(struct skynet_context * context, void * ud, int type, int session, uint
 		switch(message->type) {
 		case SKYNET_SOCKET_TYPE_DATA:
 			push_socket_data(h, message);
-			skynet_free(message->buffer);
+			skynet_readbuffer_free(message->buffer);
 			break;
 		case SKYNET_SOCKET_TYPE_ERROR:
 		case SKYNET_SOCKET_TYPE_CLOSE: {
@@ -31,6 +31,7 @@ struct snlua {
 	size_t mem_limit;
 	lua_State * activeL;
 	ATOM_INT trap;
+	ATOM_INT trace;	// signal 2 : log the traceback of the running code, 0 -> 1 (setting hook) -> -1
 };
 
 // LUA_CACHELIB may defined in patched lua for shared proto
@@ -66,7 +67,17 @@ signal_hook(lua_State *L, lua_Debug *ar) {
 	lua_getallocf(L, &ud);
 	struct snlua *l = (struct snlua *)ud;
 
+	if (ATOM_LOAD(&l->trace) == 1) {
+		// signal 2 is installing the hook and hasn't published -1 yet, keep the hook for the next instruction
+		return;
+	}
 	lua_sethook (L, NULL, 0, 0);
+	if (ATOM_LOAD(&l->trace) == -1) {
+		ATOM_STORE(&l->trace, 0);
+		luaL_traceback(L, L, "running", 0);
+		skynet_error(l->ctx, "%s", lua_tostring(L, -1));
+		lua_pop(L, 1);
+	}
 	if (ATOM_LOAD(&l->trap)) {
 		ATOM_STORE(&l->trap , 0);
 		luaL_error(L, "signal 0");
@@ -77,7 +88,7 @@ static void
 switchL(lua_State *L, struct snlua *l) {
     // LLOG("switch L: %p", L);
 	l->activeL = L;
-	if (ATOM_LOAD(&l->trap)) {
+	if (ATOM_LOAD(&l->trap) || ATOM_LOAD(&l->trace)) {
 		lua_sethook(L, signal_hook, LUA_MASKCOUNT, 1);
 	}
 }
@@ -94,6 +105,11 @@ lua_resumeX(lua_State *L, lua_State *from, int nargs, int *nresults) {
         // 这里在做什么呢
 		while (ATOM_LOAD(&l->trap) >= 0) ;
 	}
+	while (ATOM_LOAD(&l->trace) == 1) ;
+	if (from == l->L) {
+		// the message is done or suspended before the hook runs, drop the traceback, or it traces the next message
+		ATOM_CAS(&l->trace, -1, 0);
+	}
 	switchL(from, l);
 	return err;
 }
@@ -511,6 +527,7 @@ snlua_create(void) {
 	l->L = lua_newstate(lalloc, l);
 	l->activeL = NULL;
 	ATOM_INIT(&l->trap , 0);
+	ATOM_INIT(&l->trace , 0);
 	return l;
 }
 
@@ -534,5 +551,13 @@ snlua_signal(struct snlua *l, int signal) {
 		}
 	} else if (signal == 1) {
 		skynet_error(l->ctx, "Current Memory %.3fK", (float)l->mem / 1024);
+	} else if (signal == 2) {
+		// the traceback is logged in the hook, by the thread running the service
+		if (!ATOM_CAS(&l->trace, 0, 1))
+			return;
+		// activeL is NULL before the first coroutine runs, the main thread is running
+		lua_State *L = l->activeL ? l->activeL : l->L;
+		lua_sethook (L, signal_hook, LUA_MASKCOUNT, 1);
+		ATOM_CAS(&l->trace, 1, -1);
 	}
 }
@@ -157,7 +157,7 @@ function COMMAND.help()
 		task = "task address : show service task detail",
 		uniqtask = "task address : show service unique task detail",
 		inject = "inject address luascript.lua",
-		logon = "logon address",
+		logon = "logon address [text|binary]",
 		logoff = "logoff address",
 		log = "launch a new lua service with log",
 		debug = "debug address : debug a lua service",
@@ -168,6 +168,7 @@ function COMMAND.help()
 		call = "call address ...",
 		trace = "trace address [proto] [on|off]",
 		netstat = "netstat : show netstat",
+		readbuffer = "readbuffer : show the hit rate and bytes held of the socket read buffer pool",
 		profactive = "profactive [on|off] : active/deactive jemalloc heap profilling",
 		dumpheap = "dumpheap : dump heap profilling",
 		killtask = "killtask address threadname : threadname listed by task",
@@ -341,9 +342,13 @@ function COMMANDX.debug(cmd)
 	end
 end
 
-function COMMAND.logon(address)
+function COMMAND.logon(address, mode)
 	address = adjust_address(address)
-	core.command("LOGON", skynet.address(address))
+	if mode then
+		core.command("LOGON", skynet.address(address) .. " " .. mode)
+	else
+		core.command("LOGON", skynet.address(address))
+	end
 end
 
 function COMMAND.logoff(address)
@@ -464,6 +469,18 @@ function COMMAND.netstat()
 	return stat
 end
 
+function COMMAND.readbuffer()
+	local alloc = skynet.stat "readbuffer_alloc"
+	local hit = skynet.stat "readbuffer_hit"
+	local held = skynet.stat "readbuffer_held"
+	return {
+		alloc = alloc,
+		hit = hit,
+		rate = alloc > 0 and string.format("%.2f%%", hit * 100 / alloc) or "-",
+		held = string.format("%.2f Kb", held / 1024),
+	}
+end
+
 function COMMAND.dumpheap()
 	memory.dumpheap()
 end
@@ -0,0 +1,71 @@
+-- Replay the messages captured by "logon address binary" against a new service.
+-- skynet.newservice("replay", capture_file, speed, service, ...)
+--	speed : 1 keeps the captured timing, 10 is ten times faster, 0 sends all the messages at once.
+--	service, ... : the service to launch, the messages are sent to it with the captured type.
+-- The replayer is the source of all the messages, so the responses come back to it and are discarded.
+-- A captured request gets a fresh session of the replayer, no coroutine waits for it, so its response
+-- never wakes up the sleep or the call of the replayer.
+-- The captured responses and errors are skipped and counted, the new service never made the calls of
+-- their sessions; it gets the real responses of its own calls.
+
+local skynet = require "skynet"
+require "skynet.manager"	-- import skynet.kill
+local core = require "skynet.core"
+local capture = require "skynet.capture"
+
+local filename, speed, service = ...
+speed = tonumber(speed) or 1
+local service_args = table.pack(select(4, ...))
+
+local responses = 0
+
+skynet.dispatch_unknown_response(function()
+	responses = responses + 1
+end)
+
+local function replay()
+	local cap = capture.open(filename)
+	local target = skynet.newservice(service, table.unpack(service_args, 1, service_args.n))
+	local self = skynet.self()
+	local start = skynet.now()
+	local first
+	local count = 0
+	local skipped = 0
+	while true do
+		local time, source, type, session = cap:next()
+		if time == nil then
+			break
+		end
+		first = first or time
+		if type == skynet.PTYPE_RESPONSE or type == skynet.PTYPE_ERROR then
+			skipped = skipped + 1
+			goto continue
+		end
+		if speed > 0 then
+			-- skynet.now() is in centisecond, time is in microsec
+			local delay = (time - first) // (speed * 10000) - (skynet.now() - start)
+			if delay > 0 then
+				skynet.sleep(delay)
+			end
+		end
+		if session ~= 0 then
+			session = skynet.genid()
+		end
+		core.redirect(target, self, type, session, cap:message())
+		count = count + 1
+		::continue::
+	end
+	local _, truncated = cap:info()
+	cap:close()
+	-- the target has handled all the messages before it answers
+	skynet.call(target, "debug", "PING")
+	local cost = (skynet.now() - start) / 100
+	skynet.error(string.format("Replay %d messages (%d truncated, %d responses skipped) to %s in %.2fs, %d responses",
+		count, truncated, skipped, skynet.address(target), cost, responses))
+	skynet.kill(target)
+	skynet.exit()
+end
+
+skynet.start(function()
+	skynet.fork(replay)
+end)
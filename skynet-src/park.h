@@ -0,0 +1,112 @@
+#ifndef SKYNET_PARK_H
+#define SKYNET_PARK_H
+
+#include "atomic.h"
+
+// A thread parks on state while it equals to the value, another thread changes state
+// and calls park_wake to wake it up.
+
+#if defined(__linux__) && !defined(USE_PTHREAD_LOCK)
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <time.h>
+
+struct park {
+	ATOM_INT state;
+};
+
+static inline void
+park_init(struct park *p, int state) {
+	ATOM_INIT(&p->state, state);
+}
+
+static inline void
+park_wait(struct park *p, int value) {
+	while (ATOM_LOAD(&p->state) == value) {
+		syscall(SYS_futex, &p->state, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+	}
+}
+
+// returns when state changes, or after usec (maybe earlier)
+static inline void
+park_wait_timeout(struct park *p, int value, int usec) {
+	if (ATOM_LOAD(&p->state) == value) {
+		struct timespec ti;
+		ti.tv_sec = usec / 1000000;
+		ti.tv_nsec = (long)(usec % 1000000) * 1000;
+		syscall(SYS_futex, &p->state, FUTEX_WAIT_PRIVATE, value, &ti, NULL, 0);
+	}
+}
+
+static inline void
+park_wake(struct park *p) {
+	syscall(SYS_futex, &p->state, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+static inline void
+park_destroy(struct park *p) {
+	(void) p;
+}
+
+#else
+
+#include <pthread.h>
+#include <time.h>
+
+struct park {
+	ATOM_INT state;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+};
+
+static inline void
+park_init(struct park *p, int state) {
+	ATOM_INIT(&p->state, state);
+	pthread_mutex_init(&p->mutex, NULL);
+	pthread_cond_init(&p->cond, NULL);
+}
+
+static inline void
+park_wait(struct park *p, int value) {
+	pthread_mutex_lock(&p->mutex);
+	while (ATOM_LOAD(&p->state) == value) {
+		pthread_cond_wait(&p->cond, &p->mutex);
+	}
+	pthread_mutex_unlock(&p->mutex);
+}
+
+static inline void
+park_wait_timeout(struct park *p, int value, int usec) {
+	struct timespec ti;
+	clock_gettime(CLOCK_REALTIME, &ti);
+	ti.tv_sec += usec / 1000000;
+	ti.tv_nsec += (long)(usec % 1000000) * 1000;
+	if (ti.tv_nsec >= 1000000000) {
+		ti.tv_sec++;
+		ti.tv_nsec -= 1000000000;
+	}
+	pthread_mutex_lock(&p->mutex);
+	if (ATOM_LOAD(&p->state) == value) {
+		pthread_cond_timedwait(&p->cond, &p->mutex, &ti);
+	}
+	pthread_mutex_unlock(&p->mutex);
+}
+
+static inline void
+park_wake(struct park *p) {
+	pthread_mutex_lock(&p->mutex);
+	pthread_cond_signal(&p->cond);
+	pthread_mutex_unlock(&p->mutex);
+}
+
+static inline void
+park_destroy(struct park *p) {
+	pthread_mutex_destroy(&p->mutex);
+	pthread_cond_destroy(&p->cond);
+}
+
+#endif
+
+#endif
@@ -30,13 +30,29 @@ struct skynet_context;
 void skynet_error(struct skynet_context * context, const char *msg, ...);
 const char * skynet_command(struct skynet_context * context, const char * cmd , const char * parm);
 uint32_t skynet_queryname(struct skynet_context * context, const char * name);
+// changes when a named service exits, a handle queried by a local name is still bound to it if the version is the same
+int skynet_nameversion(void);
 int skynet_send(struct skynet_context * context, uint32_t source, uint32_t destination , int type, int session, void * msg, size_t sz);
 int skynet_sendname(struct skynet_context * context, uint32_t source, const char * destination , int type, int session, void * msg, size_t sz);
 
+struct skynet_batch {
+	uint32_t destination;
+	int session;	// the allocated session is written back if type has PTYPE_TAG_ALLOCSESSION
+	void * msg;
+	size_t sz;
+};
+
+// Send n messages of the same type, the messages to the same destination should be continuous in the batch,
+// they are pushed into the destination queue together. Returns the number of messages sent.
+int skynet_send_batch(struct skynet_context * context, uint32_t source, int type, struct skynet_batch * batch, int n);
+
 int skynet_isremote(struct skynet_context *, uint32_t handle, int * harbor);
 
 typedef int (*skynet_cb)(struct skynet_context * context, void *ud, int type, int session, uint32_t source , const void * msg, size_t sz);
 void skynet_callback(struct skynet_context * context, void *ud, skynet_cb cb);
+// Enable it if the callback never reserves the message, then small messages (see MESSAGE_INLINE_SIZE)
+// are copied into the message queue instead of the heap, and msg is only valid during the callback.
+void skynet_callback_inline(struct skynet_context * context, int enable);
 
 uint32_t skynet_current_handle(void);
 uint64_t skynet_now(void);
@@ -0,0 +1,90 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#include <sched.h>
+#endif
+
+#include "skynet.h"
+#include "skynet_affinity.h"
+
+#include <stdlib.h>
+
+#define MAX_CPU 1024
+
+// parse cpu list, return the number of cpus, or -1 for invalid list
+static int
+parse_cpus(const char *str, int *cpus, int max) {
+	int n = 0;
+	while (*str) {
+		char *end;
+		long from = strtol(str, &end, 10);
+		if (end == str || from < 0)
+			return -1;
+		long to = from;
+		str = end;
+		if (*str == '-') {
+			++str;
+			to = strtol(str, &end, 10);
+			if (end == str || to < from)
+				return -1;
+			str = end;
+		}
+		for (;from <= to && n < max;from++) {
+			cpus[n++] = (int)from;
+		}
+		if (*str == ',') {
+			++str;
+		} else if (*str) {
+			return -1;
+		}
+	}
+	return n;
+}
+
+#ifdef __linux__
+
+int
+skynet_affinity_bind(const char *cpus, int index) {
+	if (cpus == NULL || cpus[0] == '\0')
+		return 0;
+	int list[MAX_CPU];
+	int n = parse_cpus(cpus, list, MAX_CPU);
+	if (n <= 0) {
+		skynet_error(NULL, "error: Invalid cpu list %s", cpus);
+		return 1;
+	}
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if (index < 0) {
+		int i;
+		for (i=0;i<n;i++) {
+			if (list[i] < CPU_SETSIZE)
+				CPU_SET(list[i], &set);
+		}
+	} else if (list[index % n] < CPU_SETSIZE) {
+		CPU_SET(list[index % n], &set);
+	}
+	// Bind the thread before it allocates anything, then the memory it touches first
+	// (message queues, lua states created on it) stays in the local NUMA node.
+	if (sched_setaffinity(0, sizeof(set), &set)) {
+		skynet_error(NULL, "error: Can't bind thread to cpu %s", cpus);
+		return 1;
+	}
+	return 0;
+}
+
+#else
+
+int
+skynet_affinity_bind(const char *cpus, int index) {
+	if (cpus == NULL || cpus[0] == '\0')
+		return 0;
+	int list[MAX_CPU];
+	if (parse_cpus(cpus, list, MAX_CPU) <= 0) {
+		skynet_error(NULL, "error: Invalid cpu list %s", cpus);
+	} else {
+		skynet_error(NULL, "error: cpu affinity is not supported on this platform");
+	}
+	return 1;
+}
+
+#endif
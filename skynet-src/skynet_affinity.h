@@ -0,0 +1,9 @@
+#ifndef SKYNET_AFFINITY_H
+#define SKYNET_AFFINITY_H
+
+// cpus is a cpu list such as "0-3,8,10-11".
+// Bind the current thread to the index-th cpu of the list, or all of them if index < 0.
+// Return 0 for success, NULL or empty cpus does nothing.
+int skynet_affinity_bind(const char *cpus, int index);
+
+#endif
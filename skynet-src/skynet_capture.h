@@ -0,0 +1,50 @@
+#ifndef skynet_capture_h
+#define skynet_capture_h
+
+#include <stdint.h>
+
+// The binary message capture file (logpath/xxxxxxxx.cap), written by skynet_log in binary mode.
+// A fixed header, then a ring of records of capacity bytes. When the ring is full,
+// the oldest records are overwritten. Integers are in host byte order.
+
+#define SKYNET_CAPTURE_MAGIC "SKYCAP01"
+#define SKYNET_CAPTURE_HEADER 64
+// A record of this size is a wrap marker, the next record is at the beginning of the ring.
+// If the rest of the ring is shorter than a record, it's skipped without a marker.
+#define SKYNET_CAPTURE_WRAP 0xffffffff
+#define SKYNET_CAPTURE_ALIGN 8
+
+struct skynet_capture_header {
+	char magic[8];
+	uint32_t handle;
+	uint32_t starttime;	// skynet_starttime() of the node
+	uint64_t capacity;	// bytes of the ring after the header
+	uint64_t open_time;	// monotonic time in microsec when the file is opened
+	uint64_t head;	// bytes written since open, the ring offset is head % capacity
+	uint64_t tail;	// the oldest record, head - tail <= capacity
+};
+
+struct skynet_capture_record {
+	uint32_t size;	// bytes of payload stored after the record
+	uint32_t sz;	// the original size of the message, it's larger than size if the payload is truncated
+	uint32_t source;
+	int32_t type;
+	int32_t session;
+	uint32_t reserved;
+	uint64_t time;	// monotonic time in microsec when the message is dispatched
+};
+
+// The payload of PTYPE_SOCKET is this and then the data of the socket message (and the address for udp)
+struct skynet_capture_socket {
+	int32_t type;
+	int32_t id;
+	int32_t ud;
+	int32_t reserved;
+};
+
+static inline uint64_t
+skynet_capture_recordsize(uint32_t size) {
+	return (sizeof(struct skynet_capture_record) + size + SKYNET_CAPTURE_ALIGN - 1) & ~(uint64_t)(SKYNET_CAPTURE_ALIGN - 1);
+}
+
+#endif
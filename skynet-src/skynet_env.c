@@ -1,56 +1,121 @@
 #include "skynet.h"
 #include "skynet_env.h"
+#include "skynet_imp.h"
 #include "spinlock.h"
-
-#include <lua.h>
-#include <lauxlib.h>
+#include "atomic.h"
+#include "strhash.h"
 
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 #include <assert.h>
 
+#define ENV_DEFAULT_SIZE 64
+
+// The entries are immutable, and never freed, so skynet_getenv can return the value without copy.
+struct env_entry {
+	struct env_entry *next;
+	uint32_t hash;
+	const char *key;
+	const char *value;
+};
+
+struct env_table {
+	int size;
+	struct env_table *retired;	// the older table, kept for the readers
+	ATOM_POINTER bucket[1];	// struct env_entry *
+};
+
 struct skynet_env {
-	struct spinlock lock;
-	lua_State *L;
+	struct spinlock lock;	// for the writers
+	ATOM_POINTER table;	// struct env_table *, the snapshot readers use
+	int count;
 };
 
-// 专门用于保存配置的虚拟机
+// 保存配置的哈希表，读不加锁
 static struct skynet_env *E = NULL;
 
-// 读取配置
-const char * 
-skynet_getenv(const char *key) {
-	SPIN_LOCK(E)
+static struct env_table *
+env_table_new(int size) {
+	struct env_table *t = skynet_malloc(sizeof(*t) + (size - 1) * sizeof(t->bucket[0]));
+	t->size = size;
+	t->retired = NULL;
+	int i;
+	for (i=0;i<size;i++) {
+		ATOM_INIT(&t->bucket[i], 0);
+	}
+	return t;
+}
 
-	lua_State *L = E->L;
-	
-	lua_getglobal(L, key);
-	const char * result = lua_tostring(L, -1);
-	lua_pop(L, 1);
+static const char *
+env_find(struct env_table *t, const char *key, uint32_t hash) {
+	struct env_entry *e = (struct env_entry *)ATOM_LOAD(&t->bucket[hash & (t->size - 1)]);
+	for (; e; e = e->next) {
+		if (e->hash == hash && strcmp(e->key, key) == 0) {
+			return e->value;
+		}
+	}
+	return NULL;
+}
 
-	SPIN_UNLOCK(E)
+// 读取配置
+const char *
+skynet_getenv(const char *key) {
+	struct env_table *t = (struct env_table *)ATOM_LOAD(&E->table);
+	return env_find(t, key, strhash(key));
+}
 
-	return result;
+// Copy the table to a larger one and publish it. The key and value strings are shared.
+static struct env_table *
+env_grow(struct env_table *old) {
+	struct env_table *t = env_table_new(old->size * 2);
+	int i;
+	for (i=0;i<old->size;i++) {
+		struct env_entry *e = (struct env_entry *)ATOM_LOAD(&old->bucket[i]);
+		for (; e; e = e->next) {
+			struct env_entry *c = skynet_malloc(sizeof(*c));
+			*c = *e;
+			uint32_t idx = c->hash & (t->size - 1);
+			c->next = (struct env_entry *)ATOM_LOAD(&t->bucket[idx]);
+			ATOM_INIT(&t->bucket[idx], (uintptr_t)c);
+		}
+	}
+	// the readers may still use the old table, the sizes of retired tables add up to less than the current one
+	t->retired = old;
+	ATOM_STORE(&E->table, (uintptr_t)t);
+	return t;
 }
 
 // 写入配置
-void 
+void
 skynet_setenv(const char *key, const char *value) {
 	SPIN_LOCK(E)
-	
-	lua_State *L = E->L;
-	lua_getglobal(L, key);
-	assert(lua_isnil(L, -1));
-	lua_pop(L,1);
-	lua_pushstring(L,value);
-	lua_setglobal(L,key);
+
+	struct env_table *t = (struct env_table *)ATOM_LOAD(&E->table);
+	uint32_t hash = strhash(key);
+	assert(env_find(t, key, hash) == NULL);
+	if (E->count >= t->size) {
+		t = env_grow(t);
+	}
+
+	struct env_entry *e = skynet_malloc(sizeof(*e));
+	e->hash = hash;
+	e->key = skynet_strdup(key);
+	e->value = skynet_strdup(value);
+	uint32_t idx = hash & (t->size - 1);
+	e->next = (struct env_entry *)ATOM_LOAD(&t->bucket[idx]);
+	// publish the entry after it's initialized
+	ATOM_STORE(&t->bucket[idx], (uintptr_t)e);
+	++E->count;
 
 	SPIN_UNLOCK(E)
 }
 
-// 初始化配置虚拟机
+// 初始化配置表
 void
 skynet_env_init() {
 	E = skynet_malloc(sizeof(*E));
 	SPIN_INIT(E)
-	E->L = luaL_newstate();
+	ATOM_INIT(&E->table, (uintptr_t)env_table_new(ENV_DEFAULT_SIZE));
+	E->count = 0;
 }
@@ -3,6 +3,7 @@
 #include "skynet_imp.h"
 #include "skynet_mq.h"
 #include "skynet_server.h"
+#include "skynet_logwriter.h"
 
 #include <stdarg.h>
 #include <stdio.h>
@@ -31,8 +32,46 @@ log_try_vasprintf(char **strp, const char *fmt, va_list ap) {
 	return len;
 }
 
+// Format into the ring of current thread, no malloc and no message to the logger service
+static void
+log_async(struct skynet_context * context, const char *fmt, va_list ap) {
+	uint32_t source = context ? skynet_context_handle(context) : 0;
+	if (strcmp(fmt, "%*s") == 0) {
+		const int len = va_arg(ap, int);
+		const char *tmp = va_arg(ap, const char*);
+		skynet_logwriter_push(source, tmp, len);
+		return;
+	}
+	char tmp[LOG_MESSAGE_SIZE];
+	va_list ap2;
+	va_copy(ap2, ap);
+	int len = vsnprintf(tmp, LOG_MESSAGE_SIZE, fmt, ap);
+	if (len < 0) {
+		va_end(ap2);
+		return;
+	}
+	if (len < LOG_MESSAGE_SIZE) {
+		skynet_logwriter_push(source, tmp, len);
+	} else {
+		char *data = skynet_malloc(len + 1);
+		len = vsnprintf(data, len + 1, fmt, ap2);
+		if (len >= 0) {
+			skynet_logwriter_push(source, data, len);
+		}
+		skynet_free(data);
+	}
+	va_end(ap2);
+}
+
 void
 skynet_error(struct skynet_context * context, const char *msg, ...) {
+	if (skynet_logwriter_enabled()) {
+		va_list ap;
+		va_start(ap, msg);
+		log_async(context, msg, ap);
+		va_end(ap);
+		return;
+	}
 	static uint32_t logger = 0;
 	if (logger == 0) {
 		logger = skynet_handle_findname("logger");
@@ -4,17 +4,47 @@
 #include "skynet_imp.h"
 #include "skynet_server.h"
 #include "rwlock.h"
+#include "atomic.h"
+#include "strhash.h"
 
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
 
 #define DEFAULT_SLOT_SIZE 4
-#define MAX_SLOT_SIZE 0x40000000
+#define DEFAULT_NAME_SIZE 16
 
+// The names are in a hash table, read without lock like the slot array.
 struct handle_name {
 	char * name;
+	uint32_t hash;
 	uint32_t handle;
+	ATOM_POINTER next;	// struct handle_name * in the same bucket
+	struct handle_name *owner_next;	// the names of the same local handle, for retire
+};
+
+struct handle_name_table {
+	int size;
+	ATOM_POINTER bucket[1];	// struct handle_name *
+};
+
+// The slot array is read without lock in skynet_handle_grab.
+// The writers (under handle_storage.lock) publish a new array when it grows,
+// and free the old one after all the readers leave, see handle_synchronize.
+struct handle_slot {
+	int size;
+	ATOM_POINTER ctx[1];	// struct skynet_context *
+};
+
+// One for each thread which calls skynet_handle_grab or skynet_handle_findname.
+// seq is odd when the thread is reading the slot array or the name table.
+struct handle_reader {
+	ATOM_INT seq;
+	ATOM_INT used;
+	struct handle_reader *next;
 };
 
 // 所有 handle 的存储位置
@@ -23,36 +53,239 @@ struct handle_storage {
 
 	uint32_t harbor;
 	uint32_t handle_index;
-	int slot_size;
-	struct skynet_context ** slot;
+	ATOM_POINTER slot;	// struct handle_slot *
 
-	int name_cap;
+	pthread_key_t reader_key;
+	ATOM_POINTER reader;	// struct handle_reader * list
+
+	ATOM_POINTER name;	// struct handle_name_table *
 	int name_count;
-	struct handle_name *name;
+	ATOM_INT name_version;	// increased when a handle with names retires
+	// the names of the handle in slot[i] is owner[i], only the writers use it
+	struct handle_name **owner;
+	int owner_size;
 };
 
 static struct handle_storage *H = NULL;
 
+static inline struct handle_slot *
+slot_array(struct handle_storage *s) {
+	return (struct handle_slot *)ATOM_LOAD(&s->slot);
+}
+
+static inline struct skynet_context *
+slot_get(struct handle_slot *slot, uint32_t hash) {
+	return (struct skynet_context *)ATOM_LOAD(&slot->ctx[hash]);
+}
+
+static inline void
+slot_set(struct handle_slot *slot, uint32_t hash, struct skynet_context *ctx) {
+	ATOM_STORE(&slot->ctx[hash], (uintptr_t)ctx);
+}
+
+static struct handle_slot *
+slot_new(int size) {
+	struct handle_slot *slot = skynet_malloc(sizeof(*slot) + (size - 1) * sizeof(slot->ctx[0]));
+	slot->size = size;
+	int i;
+	for (i=0;i<size;i++) {
+		ATOM_INIT(&slot->ctx[i], 0);
+	}
+	return slot;
+}
+
+static void
+reader_exit(void *ud) {
+	struct handle_reader *r = ud;
+	ATOM_STORE(&r->used, 0);
+}
+
+// The reader of current thread, reuse the one left by an exited thread
+static struct handle_reader *
+reader_get(struct handle_storage *s) {
+	struct handle_reader *r = pthread_getspecific(s->reader_key);
+	if (r) {
+		return r;
+	}
+	for (r = (struct handle_reader *)ATOM_LOAD(&s->reader); r; r = r->next) {
+		if (ATOM_LOAD(&r->used) == 0 && ATOM_CAS(&r->used, 0, 1)) {
+			break;
+		}
+	}
+	if (r == NULL) {
+		r = skynet_malloc(sizeof(*r));
+		ATOM_INIT(&r->seq, 0);
+		ATOM_INIT(&r->used, 1);
+		uintptr_t head;
+		do {
+			head = ATOM_LOAD(&s->reader);
+			r->next = (struct handle_reader *)head;
+		} while (!ATOM_CAS_POINTER(&s->reader, head, (uintptr_t)r));
+	}
+	pthread_setspecific(s->reader_key, r);
+	return r;
+}
+
+static inline struct handle_reader *
+reader_enter(struct handle_storage *s) {
+	struct handle_reader *r = reader_get(s);
+	ATOM_FINC(&r->seq);
+	return r;
+}
+
+static inline void
+reader_leave(struct handle_reader *r) {
+	ATOM_FINC(&r->seq);
+}
+
+// Wait until the readers which may see the old slot value leave
+static void
+handle_synchronize(struct handle_storage *s) {
+	struct handle_reader *r;
+	for (r = (struct handle_reader *)ATOM_LOAD(&s->reader); r; r = r->next) {
+		int seq = ATOM_LOAD(&r->seq);
+		if (seq & 1) {
+			while (ATOM_LOAD(&r->seq) == seq) {
+				sched_yield();
+			}
+		}
+	}
+}
+
 
 void
 print_handle_storage() {
     LLOG("=== handle_storage ===");
     LLOG("harbor: %d", H->harbor);
     LLOG("handle_index: %d", H->handle_index);
-    LLOG("slot_size: %d", H->slot_size);
-    for (int i = 0; i < H->slot_size; i++) {
-        uint32_t hash = i & (H->slot_size-1);
-        struct skynet_context * ctx = H->slot[hash];
+    struct handle_slot *slot = slot_array(H);
+    LLOG("slot_size: %d", slot->size);
+    for (int i = 0; i < slot->size; i++) {
+        struct skynet_context * ctx = slot_get(slot, i);
         if (!ctx) { continue; }
         print_skynet_context(ctx);
     }
-    for (int i = 0; i < H->name_count; i++) {
-        struct handle_name n = H->name[i];
-        LLOG("name: %s \t handle: %d", n.name, n.handle);
+    struct handle_name_table *names = (struct handle_name_table *)ATOM_LOAD(&H->name);
+    for (int i = 0; i < names->size; i++) {
+        struct handle_name *n = (struct handle_name *)ATOM_LOAD(&names->bucket[i]);
+        for (; n; n = (struct handle_name *)ATOM_LOAD(&n->next)) {
+            LLOG("name: %s \t handle: %d", n->name, n->handle);
+        }
     }
 }
 
 
+static inline struct handle_name_table *
+name_table(struct handle_storage *s) {
+	return (struct handle_name_table *)ATOM_LOAD(&s->name);
+}
+
+static inline struct handle_name *
+name_next(struct handle_name *n) {
+	return (struct handle_name *)ATOM_LOAD(&n->next);
+}
+
+static struct handle_name_table *
+name_table_new(int size) {
+	struct handle_name_table *t = skynet_malloc(sizeof(*t) + (size - 1) * sizeof(t->bucket[0]));
+	t->size = size;
+	int i;
+	for (i=0;i<size;i++) {
+		ATOM_INIT(&t->bucket[i], 0);
+	}
+	return t;
+}
+
+// link the name to the owner list if it's the name of a local service
+static void
+owner_link(struct handle_storage *s, struct handle_name *n) {
+	struct handle_slot *slot = slot_array(s);
+	uint32_t hash = n->handle & (slot->size-1);
+	struct skynet_context * ctx = slot_get(slot, hash);
+	if (ctx && skynet_context_handle(ctx) == n->handle) {
+		n->owner_next = s->owner[hash];
+		s->owner[hash] = n;
+	} else {
+		n->owner_next = NULL;
+	}
+}
+
+// rebuild the owner lists when the slot array or the name table changes
+static void
+owner_rebuild(struct handle_storage *s) {
+	int size = slot_array(s)->size;
+	if (size != s->owner_size) {
+		skynet_free(s->owner);
+		s->owner = skynet_malloc(size * sizeof(struct handle_name *));
+		s->owner_size = size;
+	}
+	memset(s->owner, 0, size * sizeof(struct handle_name *));
+	struct handle_name_table *t = name_table(s);
+	int i;
+	for (i=0;i<t->size;i++) {
+		struct handle_name *n;
+		for (n = (struct handle_name *)ATOM_LOAD(&t->bucket[i]); n; n = name_next(n)) {
+			owner_link(s, n);
+		}
+	}
+}
+
+// Double the name table. The readers may walk the old buckets, so the nodes are copied, and the old ones are freed after they leave.
+static void
+name_grow(struct handle_storage *s) {
+	struct handle_name_table *old = name_table(s);
+	struct handle_name_table *t = name_table_new(old->size * 2);
+	int i;
+	for (i=0;i<old->size;i++) {
+		struct handle_name *n;
+		for (n = (struct handle_name *)ATOM_LOAD(&old->bucket[i]); n; n = name_next(n)) {
+			struct handle_name *c = skynet_malloc(sizeof(*c));
+			c->name = n->name;
+			c->hash = n->hash;
+			c->handle = n->handle;
+			uint32_t idx = c->hash & (t->size - 1);
+			ATOM_INIT(&c->next, ATOM_LOAD(&t->bucket[idx]));
+			ATOM_INIT(&t->bucket[idx], (uintptr_t)c);
+		}
+	}
+	ATOM_STORE(&s->name, (uintptr_t)t);
+	handle_synchronize(s);
+	for (i=0;i<old->size;i++) {
+		struct handle_name *n = (struct handle_name *)ATOM_LOAD(&old->bucket[i]);
+		while (n) {
+			struct handle_name *next = name_next(n);
+			skynet_free(n);
+			n = next;
+		}
+	}
+	skynet_free(old);
+	owner_rebuild(s);
+}
+
+// unlink the names of the retired handle from the buckets, returns the owner list
+static struct handle_name *
+name_unlink(struct handle_storage *s, uint32_t hash) {
+	struct handle_name *list = s->owner[hash];
+	s->owner[hash] = NULL;
+	struct handle_name_table *t = name_table(s);
+	struct handle_name *n;
+	for (n = list; n; n = n->owner_next) {
+		ATOM_POINTER *p = &t->bucket[n->hash & (t->size - 1)];
+		for (;;) {
+			struct handle_name *c = (struct handle_name *)ATOM_LOAD(p);
+			assert(c != NULL);
+			if (c == n) {
+				// the readers on n still can walk to the next
+				ATOM_STORE(p, ATOM_LOAD(&n->next));
+				break;
+			}
+			p = &c->next;
+		}
+		--s->name_count;
+	}
+	return list;
+}
+
 // 注册一个 context,返回 handle
 // 会在调用的地方将返回的 handle 设置到 ctx->handle
 uint32_t
@@ -63,19 +296,20 @@ skynet_handle_register(struct skynet_context *ctx) {
 
 	for (;;) {
 		int i;
+		struct handle_slot *slot = slot_array(s);
 		uint32_t handle = s->handle_index;
         // 从前往后，测试所有 handle
-		for (i=0;i<s->slot_size;i++,handle++) {
+		for (i=0;i<slot->size;i++,handle++) {
             // handle 超过上限会绕回
 			if (handle > HANDLE_MASK) {
 				// 0 is reserved
 				handle = 1;
 			}
-			int hash = handle & (s->slot_size-1);
+			int hash = handle & (slot->size-1);
             // 没有冲突就直接插入，否则继续找下一个可以插入的位置
             // 这里使用开放地址法解决 hash 冲突
-			if (s->slot[hash] == NULL) {
-				s->slot[hash] = ctx;
+			if (slot_get(slot, hash) == NULL) {
+				slot_set(slot, hash, ctx);
 				s->handle_index = handle + 1;
 
 				rwlock_wunlock(&s->lock);
@@ -85,21 +319,23 @@ skynet_handle_register(struct skynet_context *ctx) {
 				return handle;
 			}
 		}
-		assert((s->slot_size*2 - 1) <= HANDLE_MASK);
+		assert((slot->size*2 - 1) <= HANDLE_MASK);
         // 找不到任何插入位置的话，就将 slot 扩容为原来两倍
         // 并将原来 slot 中的内容迁移到新的 slot
-		struct skynet_context ** new_slot = skynet_malloc(s->slot_size * 2 * sizeof(struct skynet_context *));
-		memset(new_slot, 0, s->slot_size * 2 * sizeof(struct skynet_context *));
-		for (i=0;i<s->slot_size;i++) {
-			if (s->slot[i]) {
-				int hash = skynet_context_handle(s->slot[i]) & (s->slot_size * 2 - 1);
-				assert(new_slot[hash] == NULL);
-				new_slot[hash] = s->slot[i];
+		struct handle_slot * new_slot = slot_new(slot->size * 2);
+		for (i=0;i<slot->size;i++) {
+			struct skynet_context * old = slot_get(slot, i);
+			if (old) {
+				int hash = skynet_context_handle(old) & (new_slot->size - 1);
+				assert(slot_get(new_slot, hash) == NULL);
+				slot_set(new_slot, hash, old);
 			}
 		}
-		skynet_free(s->slot);
-		s->slot = new_slot;
-		s->slot_size *= 2;
+		ATOM_STORE(&s->slot, (uintptr_t)new_slot);
+		// the readers may still use the old slot array
+		handle_synchronize(s);
+		skynet_free(slot);
+		owner_rebuild(s);
         // 最后这里并没有将新的 ctx 插入进来
         // 这是因为这里是一个无限循环，在下一个循环重新找位置进行插入
         // 并返回，这种写法降低了逻辑复杂度
@@ -116,28 +352,27 @@ skynet_handle_retire(uint32_t handle) {
 
     // 通过 handle 计算 hash
     // 通过 hash 拿到 skynet_context
-	uint32_t hash = handle & (s->slot_size-1);
-	struct skynet_context * ctx = s->slot[hash];
+	struct handle_slot *slot = slot_array(s);
+	uint32_t hash = handle & (slot->size-1);
+	struct skynet_context * ctx = slot_get(slot, hash);
 
 	if (ctx != NULL && skynet_context_handle(ctx) == handle) {
-		s->slot[hash] = NULL;
+		slot_set(slot, hash, NULL);
+        // 从名字表中摘掉这个 handle 的所有名字
+		struct handle_name *names = name_unlink(s, hash);
+		if (names) {
+			// the names can be bound again only after the version changes, see skynet_nameversion
+			ATOM_FINC(&s->name_version);
+		}
+		// skynet_handle_grab may have read ctx, and skynet_handle_findname may read the names, wait them leave.
+		handle_synchronize(s);
 		ret = 1;
-		int i;
-		int j=0, n=s->name_count;
-        // 遍历所有节点，如果节点是要退休的节点，那么释放 s->name
-        // 数组中对应位置的字符串，然后将s->name 数组后面的内容
-        // 往前移动一个位置
-		for (i=0; i<n; ++i) {
-			if (s->name[i].handle == handle) {
-				skynet_free(s->name[i].name);
-				continue;
-			} else if (i!=j) {
-                //
-				s->name[j] = s->name[i];
-			}
-			++j;
+		while (names) {
+			struct handle_name *next = names->owner_next;
+			skynet_free(names->name);
+			skynet_free(names);
+			names = next;
 		}
-		s->name_count = j;
 	} else {
 		ctx = NULL;
 	}
@@ -160,9 +395,15 @@ skynet_handle_retireall() {
 	for (;;) {
 		int n=0;
 		int i;
-		for (i=0;i<s->slot_size;i++) {
+		for (i=0;;i++) {
+			// the slot array may grow and the old one be freed, read it only with the lock
 			rwlock_rlock(&s->lock);
-			struct skynet_context * ctx = s->slot[i];
+			struct handle_slot *slot = slot_array(s);
+			if (i >= slot->size) {
+				rwlock_runlock(&s->lock);
+				break;
+			}
+			struct skynet_context * ctx = slot_get(slot, i);
 			uint32_t handle = 0;
 			if (ctx) {
 				handle = skynet_context_handle(ctx);
@@ -179,125 +420,95 @@ skynet_handle_retireall() {
 }
 
 // 通过 handle 获取 skynet_context
+// It doesn't lock : the writers wait the reader leaves before they free the slot array or release the ctx.
 struct skynet_context *
 skynet_handle_grab(uint32_t handle) {
 	struct handle_storage *s = H;
 	struct skynet_context * result = NULL;
+	struct handle_reader *r = reader_enter(s);
 
-	rwlock_rlock(&s->lock);
-
+	struct handle_slot *slot = slot_array(s);
     // 这里的 handle 高 8 位其实是 harbor ID
     // 但是因为使用了 &, 结果的高 8 位会直接变为 0，所以不需要考虑
-	uint32_t hash = handle & (s->slot_size-1);
-	struct skynet_context * ctx = s->slot[hash];
+	uint32_t hash = handle & (slot->size-1);
+	struct skynet_context * ctx = slot_get(slot, hash);
 	if (ctx && skynet_context_handle(ctx) == handle) {
 		result = ctx;
         // 增加 context 的引用计数
 		skynet_context_grab(result);
 	}
 
-	rwlock_runlock(&s->lock);
+	reader_leave(r);
 
 	return result;
 }
 
-// 二分法查找，通过 name 找到 handle
+int
+skynet_handle_nameversion() {
+	return ATOM_LOAD(&H->name_version);
+}
+
+// 通过 name 找到 handle, it doesn't lock as skynet_handle_grab
 uint32_t
 skynet_handle_findname(const char * name) {
 	struct handle_storage *s = H;
-    // LLOG("name=%s", name); // launcher/service/cslave etc.
-
-	rwlock_rlock(&s->lock);
-
+	uint32_t hash = strhash(name);
 	uint32_t handle = 0;
 
-	int begin = 0;
-	int end = s->name_count - 1;
-	while (begin<=end) {
-		int mid = (begin+end)/2;
-		struct handle_name *n = &s->name[mid];
-		int c = strcmp(n->name, name);
-		if (c==0) {
+	struct handle_reader *r = reader_enter(s);
+
+	struct handle_name_table *t = name_table(s);
+	struct handle_name *n = (struct handle_name *)ATOM_LOAD(&t->bucket[hash & (t->size - 1)]);
+	for (; n; n = name_next(n)) {
+		if (n->hash == hash && strcmp(n->name, name) == 0) {
 			handle = n->handle;
 			break;
 		}
-		if (c<0) {
-			begin = mid + 1;
-		} else {
-			end = mid - 1;
-		}
 	}
 
-	rwlock_runlock(&s->lock);
+	reader_leave(r);
 
 	return handle;
 }
 
-// 二分法插入，能选择这个办法应该是因为 s->name 数组中的成员变动较少
-// s->name 数组按照字典序排序，所以按照 name 找 handle 可以直接二分搜索
-static void
-_insert_name_before(struct handle_storage *s, char *name, uint32_t handle, int before) {
-	if (s->name_count >= s->name_cap) {
-		s->name_cap *= 2;
-		assert(s->name_cap <= MAX_SLOT_SIZE);
-		struct handle_name * n = skynet_malloc(s->name_cap * sizeof(struct handle_name));
-		int i;
-		for (i=0;i<before;i++) {
-			n[i] = s->name[i];
-		}
-		for (i=before;i<s->name_count;i++) {
-			n[i+1] = s->name[i];
-		}
-		skynet_free(s->name);
-		s->name = n;
-	} else {
-		int i;
-		for (i=s->name_count;i>before;i--) {
-			s->name[i] = s->name[i-1];
-		}
-	}
-	s->name[before].name = name;
-	s->name[before].handle = handle;
-	s->name_count ++;
-}
-
-// 将 (name, handle) 插入到 handle_storage
-// 返回一个复制后的 name 字符串的地址
+// 将 (name, handle) 插入到名字表
+// 返回一个复制后的 name 字符串的地址，名字已经存在时返回 NULL
 static const char *
 _insert_name(struct handle_storage *s, const char * name, uint32_t handle) {
-	int begin = 0;
-	int end = s->name_count - 1;
-	while (begin<=end) {
-		int mid = (begin+end)/2;
-		struct handle_name *n = &s->name[mid];
-		int c = strcmp(n->name, name);
-		if (c==0) {
+	uint32_t hash = strhash(name);
+	struct handle_name_table *t = name_table(s);
+	struct handle_name *n;
+	for (n = (struct handle_name *)ATOM_LOAD(&t->bucket[hash & (t->size - 1)]); n; n = name_next(n)) {
+		if (n->hash == hash && strcmp(n->name, name) == 0) {
 			return NULL;
 		}
-		if (c<0) {
-			begin = mid + 1;
-		} else {
-			end = mid - 1;
-		}
 	}
-    // 复制一下 name
-	char * result = skynet_strdup(name);
-
-	_insert_name_before(s, result, handle, begin);
+	if (s->name_count >= t->size) {
+		name_grow(s);
+		t = name_table(s);
+	}
 
-	return result;
+	n = skynet_malloc(sizeof(*n));
+    // 复制一下 name
+	n->name = skynet_strdup(name);
+	n->hash = hash;
+	n->handle = handle;
+	uint32_t idx = hash & (t->size - 1);
+	ATOM_INIT(&n->next, ATOM_LOAD(&t->bucket[idx]));
+	// publish the node after it's initialized
+	ATOM_STORE(&t->bucket[idx], (uintptr_t)n);
+	++s->name_count;
+	owner_link(s, n);
+
+	return n->name;
 }
 
-// 将 (name, handle) 信息插入到 handle_storage->name 数组
-// handle_storage->name 数组按照 name 的字典序排列
 const char *
 skynet_handle_namehandle(uint32_t handle, const char *name) {
 	rwlock_wlock(&H->lock);
 
 	const char * ret = _insert_name(H, name, handle);
 
-    print_handle_storage();
-
 	rwlock_wunlock(&H->lock);
 
 	return ret;
@@ -308,17 +519,23 @@ skynet_handle_init(int harbor) {
 	assert(H==NULL);
     // 初始化 handle_storage
 	struct handle_storage * s = skynet_malloc(sizeof(*H));
-	s->slot_size = DEFAULT_SLOT_SIZE;
-	s->slot = skynet_malloc(s->slot_size * sizeof(struct skynet_context *));
-	memset(s->slot, 0, s->slot_size * sizeof(struct skynet_context *));
+	ATOM_INIT(&s->slot, (uintptr_t)slot_new(DEFAULT_SLOT_SIZE));
+	ATOM_INIT(&s->reader, 0);
+	if (pthread_key_create(&s->reader_key, reader_exit)) {
+		fprintf(stderr, "pthread_key_create failed");
+		exit(1);
+	}
 
 	rwlock_init(&s->lock);
 	// reserve 0 for system
 	s->harbor = (uint32_t) (harbor & 0xff) << HANDLE_REMOTE_SHIFT;
 	s->handle_index = 1;
-	s->name_cap = 2;
+	ATOM_INIT(&s->name, (uintptr_t)name_table_new(DEFAULT_NAME_SIZE));
 	s->name_count = 0;
-	s->name = skynet_malloc(s->name_cap * sizeof(struct handle_name));
+	ATOM_INIT(&s->name_version, 0);
+	s->owner_size = DEFAULT_SLOT_SIZE;
+	s->owner = skynet_malloc(s->owner_size * sizeof(struct handle_name *));
+	memset(s->owner, 0, s->owner_size * sizeof(struct handle_name *));
 
 	H = s;
 
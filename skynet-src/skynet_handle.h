@@ -15,6 +15,7 @@ struct skynet_context * skynet_handle_grab(uint32_t handle);
 void skynet_handle_retireall();
 
 uint32_t skynet_handle_findname(const char * name);
+int skynet_handle_nameversion();
 const char * skynet_handle_namehandle(uint32_t handle, const char *name);
 
 void skynet_handle_init(int harbor);
@@ -0,0 +1,94 @@
+#include "skynet.h"
+#include "skynet_histogram.h"
+
+#include <string.h>
+
+// Values below SUB_COUNT have their own buckets, then each power of two has SUB_COUNT buckets.
+#define SUB_BITS 3
+#define SUB_COUNT (1 << SUB_BITS)
+#define BUCKET_COUNT ((32 - SUB_BITS + 1) * SUB_COUNT)
+
+struct skynet_histogram {
+	uint64_t count;
+	uint32_t max;
+	uint32_t bucket[BUCKET_COUNT];
+};
+
+static inline int
+highbit(uint32_t v) {
+	return 31 - __builtin_clz(v);
+}
+
+static inline int
+bucket_index(uint32_t v) {
+	if (v < SUB_COUNT) {
+		return (int)v;
+	}
+	int shift = highbit(v) - SUB_BITS;
+	return (shift + 1) * SUB_COUNT + (int)((v >> shift) & (SUB_COUNT - 1));
+}
+
+// the largest value in bucket i
+static uint32_t
+bucket_upper(int i) {
+	if (i < SUB_COUNT) {
+		return (uint32_t)i;
+	}
+	int shift = i / SUB_COUNT - 1;
+	uint64_t base = (uint64_t)(SUB_COUNT + i % SUB_COUNT) << shift;
+	return (uint32_t)(base + ((uint64_t)1 << shift) - 1);
+}
+
+struct skynet_histogram *
+skynet_histogram_new(void) {
+	struct skynet_histogram *h = skynet_malloc(sizeof(*h));
+	memset(h, 0, sizeof(*h));
+	return h;
+}
+
+void
+skynet_histogram_delete(struct skynet_histogram *h) {
+	skynet_free(h);
+}
+
+void
+skynet_histogram_record(struct skynet_histogram *h, uint32_t v) {
+	++h->bucket[bucket_index(v)];
+	++h->count;
+	if (v > h->max) {
+		h->max = v;
+	}
+}
+
+uint64_t
+skynet_histogram_count(struct skynet_histogram *h) {
+	return h->count;
+}
+
+uint32_t
+skynet_histogram_max(struct skynet_histogram *h) {
+	return h->max;
+}
+
+uint32_t
+skynet_histogram_quantile(struct skynet_histogram *h, double q) {
+	if (h->count == 0) {
+		return 0;
+	}
+	uint64_t rank = (uint64_t)(q * h->count + 0.5);
+	if (rank < 1) {
+		rank = 1;
+	} else if (rank > h->count) {
+		rank = h->count;
+	}
+	uint64_t n = 0;
+	int i;
+	for (i=0;i<BUCKET_COUNT;i++) {
+		n += h->bucket[i];
+		if (n >= rank) {
+			uint32_t upper = bucket_upper(i);
+			return upper < h->max ? upper : h->max;
+		}
+	}
+	return h->max;
+}
@@ -0,0 +1,18 @@
+#ifndef skynet_histogram_h
+#define skynet_histogram_h
+
+#include <stdint.h>
+
+// Log-linear histogram (like HdrHistogram) of uint32 values, the relative error is 1/8.
+
+struct skynet_histogram;
+
+struct skynet_histogram * skynet_histogram_new(void);
+void skynet_histogram_delete(struct skynet_histogram *h);
+void skynet_histogram_record(struct skynet_histogram *h, uint32_t v);
+uint64_t skynet_histogram_count(struct skynet_histogram *h);
+uint32_t skynet_histogram_max(struct skynet_histogram *h);
+// q in [0,1], returns the upper bound of the bucket
+uint32_t skynet_histogram_quantile(struct skynet_histogram *h, double q);
+
+#endif
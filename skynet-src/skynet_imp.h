@@ -7,11 +7,30 @@ struct skynet_config {
 	int thread;
 	int harbor;
 	int profile;
+	int latency;
+	int timeslice;
+	int spin;
+	int timer_precision;	// in millisecond, 1 or 10
+	int timer_event;	// the timer thread sleeps until the next expiry instead of polling
+	int slow_threshold;	// in millisecond, log the messages which take longer, 0 means off
+	int socket_thread;	// number of socket threads, each polls a shard of the sockets
+	int socket_uring;	// socket threads use io_uring instead of epoll if the kernel supports
+	int socket_readpool;	// pool the socket read buffers, see skynet_readbuffer.h
 	const char * daemon;
 	const char * module_path;
 	const char * bootstrap;
 	const char * logger;
 	const char * logservice;
+	int logasync;	// skynet_error writes to the logger file through skynet_logwriter, instead of logservice
+	int logbuffer;	// ring buffer size of each thread in bytes
+	int logflush;	// max delay of log lines in millisecond
+	int logrotate_size;	// in MB, 0 means never
+	int logrotate_time;	// in second, 0 means never
+	// cpu lists for each thread class, NULL means no affinity
+	const char * affinity_worker;
+	const char * affinity_socket;
+	const char * affinity_timer;
+	const char * affinity_monitor;
 };
 
 #define THREAD_WORKER 0
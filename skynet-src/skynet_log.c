@@ -2,36 +2,130 @@
 #include "skynet_timer.h"
 #include "skynet.h"
 #include "skynet_socket.h"
+#include "skynet_capture.h"
 #include <string.h>
+#include <stdlib.h>
 #include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
-FILE * 
-skynet_log_open(struct skynet_context * ctx, uint32_t handle) {
-	const char * logpath = skynet_getenv("logpath");
-	if (logpath == NULL)
-		return NULL;
-	size_t sz = strlen(logpath);
-	char tmp[sz + 16];
-	sprintf(tmp, "%s/%08x.log", logpath, handle);
-	FILE *f = fopen(tmp, "ab");
+// the ring size of binary capture in MB
+#define DEFAULT_CAPTURE_SIZE 16
+
+struct skynet_log {
+	FILE *f;	// text mode, NULL for binary
+	// binary mode
+	struct skynet_capture_header *header;
+	char *ring;
+	size_t map_size;
+};
+
+static int
+binary_mode(const char * mode) {
+	if (mode == NULL) {
+		mode = skynet_getenv("logformat");
+	}
+	return mode && strcmp(mode, "binary") == 0;
+}
+
+static FILE *
+text_open(struct skynet_context * ctx, const char * filename) {
+	FILE *f = fopen(filename, "ab");
 	if (f) {
 		uint32_t starttime = skynet_starttime();
 		uint64_t currenttime = skynet_now();
 		time_t ti = starttime + currenttime/100;
-		skynet_error(ctx, "Open log file %s", tmp);
+		skynet_error(ctx, "Open log file %s", filename);
 		fprintf(f, "open time: %u %s", (uint32_t)currenttime, ctime(&ti));
 		fflush(f);
 	} else {
-		skynet_error(ctx, "Open log file %s fail", tmp);
+		skynet_error(ctx, "Open log file %s fail", filename);
 	}
 	return f;
 }
 
+// Map the file as a header and a ring, the old content is discarded
+static int
+capture_open(struct skynet_context * ctx, struct skynet_log *log, const char * filename, uint32_t handle) {
+	const char * size = skynet_getenv("logcapture");
+	uint64_t capacity = (uint64_t)(size ? strtoul(size, NULL, 10) : DEFAULT_CAPTURE_SIZE) * 1024 * 1024;
+	if (capacity == 0) {
+		capacity = DEFAULT_CAPTURE_SIZE * 1024 * 1024;
+	}
+	int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		skynet_error(ctx, "Open capture file %s fail", filename);
+		return 1;
+	}
+	size_t map_size = SKYNET_CAPTURE_HEADER + capacity;
+	if (ftruncate(fd, map_size)) {
+		skynet_error(ctx, "Resize capture file %s fail", filename);
+		close(fd);
+		return 1;
+	}
+	void * ptr = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (ptr == MAP_FAILED) {
+		skynet_error(ctx, "Map capture file %s fail", filename);
+		return 1;
+	}
+	struct skynet_capture_header *h = ptr;
+	memcpy(h->magic, SKYNET_CAPTURE_MAGIC, sizeof(h->magic));
+	h->handle = handle;
+	h->starttime = skynet_starttime();
+	h->capacity = capacity;
+	h->open_time = skynet_monotonic_time();
+	h->head = 0;
+	h->tail = 0;
+	log->header = h;
+	log->ring = (char *)ptr + SKYNET_CAPTURE_HEADER;
+	log->map_size = map_size;
+	skynet_error(ctx, "Open capture file %s", filename);
+	return 0;
+}
+
+struct skynet_log *
+skynet_log_open(struct skynet_context * ctx, uint32_t handle, const char * mode) {
+	const char * logpath = skynet_getenv("logpath");
+	if (logpath == NULL)
+		return NULL;
+	size_t sz = strlen(logpath);
+	char tmp[sz + 16];
+	struct skynet_log * log = skynet_malloc(sizeof(*log));
+	memset(log, 0, sizeof(*log));
+	if (binary_mode(mode)) {
+		sprintf(tmp, "%s/%08x.cap", logpath, handle);
+		if (capture_open(ctx, log, tmp, handle)) {
+			skynet_free(log);
+			return NULL;
+		}
+	} else {
+		sprintf(tmp, "%s/%08x.log", logpath, handle);
+		log->f = text_open(ctx, tmp);
+		if (log->f == NULL) {
+			skynet_free(log);
+			return NULL;
+		}
+	}
+	return log;
+}
+
 void
-skynet_log_close(struct skynet_context * ctx, FILE *f, uint32_t handle) {
-	skynet_error(ctx, "Close log file :%08x", handle);
-	fprintf(f, "close time: %u\n", (uint32_t)skynet_now());
-	fclose(f);
+skynet_log_close(struct skynet_context * ctx, struct skynet_log *log, uint32_t handle) {
+	if (log->f) {
+		if (ctx) {
+			skynet_error(ctx, "Close log file :%08x", handle);
+		}
+		fprintf(log->f, "close time: %u\n", (uint32_t)skynet_now());
+		fclose(log->f);
+	} else {
+		if (ctx) {
+			skynet_error(ctx, "Close capture file :%08x", handle);
+		}
+		munmap(log->header, log->map_size);
+	}
+	skynet_free(log);
 }
 
 static void
@@ -63,9 +157,95 @@ log_socket(FILE * f, struct skynet_socket_message * message, size_t sz) {
 	fflush(f);
 }
 
-void 
-skynet_log_output(FILE *f, uint32_t source, int type, int session, void * buffer, size_t sz) {
-	if (type == PTYPE_SOCKET) {
+// Move tail forward until the ring has room for head
+static void
+capture_reclaim(struct skynet_capture_header *h, const char *ring, uint64_t head) {
+	uint64_t cap = h->capacity;
+	uint64_t tail = h->tail;
+	while (head - tail > cap) {
+		uint64_t offset = tail % cap;
+		uint64_t rest = cap - offset;
+		const struct skynet_capture_record *rec = (const struct skynet_capture_record *)(ring + offset);
+		if (rest < sizeof(*rec) || rec->size == SKYNET_CAPTURE_WRAP) {
+			tail += rest;
+		} else {
+			tail += skynet_capture_recordsize(rec->size);
+		}
+	}
+	h->tail = tail;
+}
+
+// Only the worker which dispatches the service writes, so it needs no lock.
+// The payload is prefix and then data, truncated to a quarter of the ring.
+static void
+capture_write(struct skynet_log *log, uint32_t source, int type, int session, const void *prefix, size_t prefix_sz, const void *data, size_t sz) {
+	struct skynet_capture_header *h = log->header;
+	uint64_t cap = h->capacity;
+	size_t total = prefix_sz + sz;
+	size_t size = total;
+	size_t limit = cap / 4 - sizeof(struct skynet_capture_record);
+	if (size > limit) {
+		size = limit;
+	}
+	uint64_t need = skynet_capture_recordsize(size);
+	uint64_t head = h->head;
+	uint64_t offset = head % cap;
+	uint64_t skip = offset + need > cap ? cap - offset : 0;
+	capture_reclaim(h, log->ring, head + skip + need);
+	if (skip) {
+		if (skip >= sizeof(struct skynet_capture_record)) {
+			struct skynet_capture_record *wrap = (struct skynet_capture_record *)(log->ring + offset);
+			wrap->size = SKYNET_CAPTURE_WRAP;
+		}
+		offset = 0;
+	}
+	struct skynet_capture_record *rec = (struct skynet_capture_record *)(log->ring + offset);
+	rec->size = (uint32_t)size;
+	rec->sz = (uint32_t)total;
+	rec->source = source;
+	rec->type = type;
+	rec->session = session;
+	rec->reserved = 0;
+	rec->time = skynet_monotonic_time();
+	char *payload = (char *)(rec + 1);
+	if (prefix_sz > size) {
+		prefix_sz = size;
+	}
+	memcpy(payload, prefix, prefix_sz);
+	memcpy(payload + prefix_sz, data, size - prefix_sz);
+	h->head = head + skip + need;
+}
+
+static void
+capture_socket(struct skynet_log *log, uint32_t source, int session, struct skynet_socket_message * message, size_t sz) {
+	struct skynet_capture_socket s;
+	s.type = message->type;
+	s.id = message->id;
+	s.ud = message->ud;
+	s.reserved = 0;
+	if (message->buffer == NULL) {
+		capture_write(log, source, PTYPE_SOCKET, session, &s, sizeof(s), message + 1, sz - sizeof(*message));
+	} else {
+		size_t data_sz = message->ud;
+		int addrsz = 0;
+		if (skynet_socket_udp_address(message, &addrsz)) {
+			// the udp address is after the data
+			data_sz += addrsz;
+		}
+		capture_write(log, source, PTYPE_SOCKET, session, &s, sizeof(s), message->buffer, data_sz);
+	}
+}
+
+void
+skynet_log_output(struct skynet_log *log, uint32_t source, int type, int session, void * buffer, size_t sz) {
+	FILE *f = log->f;
+	if (f == NULL) {
+		if (type == PTYPE_SOCKET) {
+			capture_socket(log, source, session, buffer, sz);
+		} else {
+			capture_write(log, source, type, session, NULL, 0, buffer, sz);
+		}
+	} else if (type == PTYPE_SOCKET) {
 		log_socket(f, buffer, sz);
 	} else {
 		uint32_t ti = (uint32_t)skynet_now();
@@ -7,8 +7,12 @@
 #include <stdio.h>
 #include <stdint.h>
 
-FILE * skynet_log_open(struct skynet_context * ctx, uint32_t handle);
-void skynet_log_close(struct skynet_context * ctx, FILE *f, uint32_t handle);
-void skynet_log_output(FILE *f, uint32_t source, int type, int session, void * buffer, size_t sz);
+struct skynet_log;
 
-#endif
\ No newline at end of file
+// mode is "text" or "binary", NULL for the default (env logformat)
+struct skynet_log * skynet_log_open(struct skynet_context * ctx, uint32_t handle, const char * mode);
+// ctx is NULL if the service is deleting
+void skynet_log_close(struct skynet_context * ctx, struct skynet_log *log, uint32_t handle);
+void skynet_log_output(struct skynet_log *log, uint32_t source, int type, int session, void * buffer, size_t sz);
+
+#endif
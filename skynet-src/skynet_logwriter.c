@@ -0,0 +1,429 @@
+#include "skynet.h"
+#include "skynet_logwriter.h"
+#include "skynet_timer.h"
+#include "atomic.h"
+#include "park.h"
+
+#include <pthread.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define WRITER_SLEEP 0
+#define WRITER_AWAKE 1
+
+#define MIN_RING_SIZE 4096
+#define RECORD_WRAP 0xffffffff
+// lines in one writev, each line takes 3 iovecs (prefix, message, eol)
+#define BATCH_LINES 256
+#define PREFIX_SIZE 64
+#define TIMEFMT_SIZE 32
+
+// Records are aligned to the header size, so a header never crosses the end of the ring.
+struct log_record {
+	uint32_t source;
+	uint32_t sz;	// RECORD_WRAP means the rest of the ring is skipped
+	uint64_t time;	// skynet_now()
+};
+
+// Single producer (the owner thread), single consumer (the writer thread).
+struct log_ring {
+	ATOM_SIZET head;
+	ATOM_SIZET tail;
+	ATOM_SIZET dropped;
+	ATOM_INT used;
+	struct log_ring *next;
+	char *buffer;
+};
+
+struct log_pending {
+	struct log_ring *ring;
+	size_t tail;
+};
+
+struct log_batch {
+	int n;
+	int npending;
+	struct iovec iov[BATCH_LINES * 3];
+	char prefix[BATCH_LINES][PREFIX_SIZE];
+	struct log_pending pending[BATCH_LINES];
+};
+
+struct logwriter {
+	size_t ring_size;	// power of 2
+	int flush;	// microsec
+	size_t rotate_size;
+	int rotate_time;
+	char *filename;
+	int fd;
+	size_t file_size;
+	time_t file_time;
+	uint32_t starttime;
+	time_t last_sec;
+	char timefmt[TIMEFMT_SIZE];
+	size_t reported;	// dropped lines already reported
+	char dropmsg[64];
+	pthread_key_t ring_key;
+	ATOM_POINTER ring;	// struct log_ring * list
+	ATOM_INT reopen;
+	ATOM_INT quit;
+	struct park p;
+	pthread_t thread;
+	struct log_batch batch;
+};
+
+static struct logwriter *W = NULL;
+
+static inline size_t
+record_size(size_t sz) {
+	size_t align = sizeof(struct log_record);
+	return (align + sz + align - 1) & ~(align - 1);
+}
+
+static void
+ring_exit(void *ud) {
+	struct log_ring *r = ud;
+	ATOM_STORE(&r->used, 0);
+}
+
+// The ring of current thread, reuse the one left by an exited thread
+static struct log_ring *
+ring_get(struct logwriter *w) {
+	struct log_ring *r = pthread_getspecific(w->ring_key);
+	if (r) {
+		return r;
+	}
+	for (r = (struct log_ring *)ATOM_LOAD(&w->ring); r; r = r->next) {
+		if (ATOM_LOAD(&r->used) == 0 && ATOM_CAS(&r->used, 0, 1)) {
+			break;
+		}
+	}
+	if (r == NULL) {
+		r = skynet_malloc(sizeof(*r));
+		ATOM_INIT(&r->head, 0);
+		ATOM_INIT(&r->tail, 0);
+		ATOM_INIT(&r->dropped, 0);
+		ATOM_INIT(&r->used, 1);
+		r->buffer = skynet_malloc(w->ring_size);
+		uintptr_t head;
+		do {
+			head = ATOM_LOAD(&w->ring);
+			r->next = (struct log_ring *)head;
+		} while (!ATOM_CAS_POINTER(&w->ring, head, (uintptr_t)r));
+	}
+	pthread_setspecific(w->ring_key, r);
+	return r;
+}
+
+static void
+writer_wake(struct logwriter *w) {
+	if (ATOM_LOAD(&w->p.state) == WRITER_SLEEP && ATOM_CAS(&w->p.state, WRITER_SLEEP, WRITER_AWAKE)) {
+		park_wake(&w->p);
+	}
+}
+
+int
+skynet_logwriter_enabled(void) {
+	return W != NULL;
+}
+
+int
+skynet_logwriter_push(uint32_t source, const char *msg, size_t sz) {
+	struct logwriter *w = W;
+	struct log_ring *r = ring_get(w);
+	size_t cap = w->ring_size;
+	// a line can't take more than a quarter of the ring
+	if (record_size(sz) > cap / 4) {
+		sz = cap / 4 - sizeof(struct log_record);
+	}
+	size_t need = record_size(sz);
+	size_t head = ATOM_LOAD(&r->head);
+	size_t tail = ATOM_LOAD(&r->tail);
+	size_t offset = head & (cap - 1);
+	size_t skip = offset + need > cap ? cap - offset : 0;
+	if (head + skip + need - tail > cap) {
+		ATOM_FINC(&r->dropped);
+		writer_wake(w);
+		return 0;
+	}
+	if (skip) {
+		struct log_record *wrap = (struct log_record *)(r->buffer + offset);
+		wrap->sz = RECORD_WRAP;
+		offset = 0;
+	}
+	struct log_record *rec = (struct log_record *)(r->buffer + offset);
+	rec->source = source;
+	rec->sz = (uint32_t)sz;
+	rec->time = skynet_now();
+	memcpy(rec + 1, msg, sz);
+	head += skip + need;
+	ATOM_STORE(&r->head, head);
+	if (head - tail > cap / 2) {
+		writer_wake(w);
+	}
+	return 1;
+}
+
+void
+skynet_logwriter_reopen(void) {
+	if (W) {
+		ATOM_STORE(&W->reopen, 1);
+		writer_wake(W);
+	}
+}
+
+size_t
+skynet_logwriter_dropped(void) {
+	size_t n = 0;
+	if (W) {
+		struct log_ring *r;
+		for (r = (struct log_ring *)ATOM_LOAD(&W->ring); r; r = r->next) {
+			n += ATOM_LOAD(&r->dropped);
+		}
+	}
+	return n;
+}
+
+static void
+write_all(struct logwriter *w, struct iovec *iov, int n) {
+	while (n > 0) {
+		ssize_t r = writev(w->fd, iov, n);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			// the lines are lost, nowhere to report
+			return;
+		}
+		w->file_size += r;
+		while (n > 0 && (size_t)r >= iov->iov_len) {
+			r -= iov->iov_len;
+			++iov;
+			--n;
+		}
+		if (n > 0) {
+			iov->iov_base = (char *)iov->iov_base + r;
+			iov->iov_len -= r;
+		}
+	}
+}
+
+static void
+batch_flush(struct logwriter *w, struct log_batch *b) {
+	write_all(w, b->iov, b->n * 3);
+	int i;
+	for (i=0;i<b->npending;i++) {
+		ATOM_STORE(&b->pending[i].ring->tail, b->pending[i].tail);
+	}
+	b->n = 0;
+	b->npending = 0;
+}
+
+static void
+batch_line(struct logwriter *w, struct log_batch *b, uint32_t source, uint64_t now, const char *msg, size_t sz) {
+	char *prefix = b->prefix[b->n];
+	int len;
+	if (w->filename) {
+		time_t sec = w->starttime + now / 100;
+		if (sec != w->last_sec) {
+			struct tm info;
+			(void)localtime_r(&sec, &info);
+			strftime(w->timefmt, TIMEFMT_SIZE, "%d/%m/%y %H:%M:%S", &info);
+			w->last_sec = sec;
+		}
+		len = snprintf(prefix, PREFIX_SIZE, "%s.%02d [:%08x] ", w->timefmt, (int)(now % 100), source);
+	} else {
+		len = snprintf(prefix, PREFIX_SIZE, "[:%08x] ", source);
+	}
+	struct iovec *iov = &b->iov[b->n * 3];
+	iov[0].iov_base = prefix;
+	iov[0].iov_len = len;
+	iov[1].iov_base = (void *)msg;
+	iov[1].iov_len = sz;
+	iov[2].iov_base = "\n";
+	iov[2].iov_len = 1;
+	++b->n;
+}
+
+// The ring can be released to tail after the batch is written
+static void
+batch_pending(struct logwriter *w, struct log_batch *b, struct log_ring *r, size_t tail) {
+	if (b->npending > 0 && b->pending[b->npending-1].ring == r) {
+		b->pending[b->npending-1].tail = tail;
+		return;
+	}
+	if (b->npending == BATCH_LINES) {
+		batch_flush(w, b);
+	}
+	b->pending[b->npending].ring = r;
+	b->pending[b->npending].tail = tail;
+	++b->npending;
+}
+
+static void
+drain_ring(struct logwriter *w, struct log_batch *b, struct log_ring *r) {
+	size_t cap = w->ring_size;
+	size_t tail = ATOM_LOAD(&r->tail);
+	size_t head = ATOM_LOAD(&r->head);
+	while (tail != head) {
+		size_t offset = tail & (cap - 1);
+		struct log_record *rec = (struct log_record *)(r->buffer + offset);
+		if (rec->sz == RECORD_WRAP) {
+			tail += cap - offset;
+		} else {
+			if (b->n == BATCH_LINES) {
+				batch_flush(w, b);
+			}
+			batch_line(w, b, rec->source, rec->time, (const char *)(rec + 1), rec->sz);
+			tail += record_size(rec->sz);
+		}
+		batch_pending(w, b, r, tail);
+	}
+}
+
+// Lines are grouped by thread in a batch, they are in order for each thread.
+static void
+drain(struct logwriter *w) {
+	struct log_batch *b = &w->batch;
+	size_t dropped = skynet_logwriter_dropped();
+	if (dropped != w->reported) {
+		int len = snprintf(w->dropmsg, sizeof(w->dropmsg), "%zu log lines dropped", dropped - w->reported);
+		w->reported = dropped;
+		batch_line(w, b, 0, skynet_now(), w->dropmsg, len);
+	}
+	struct log_ring *r;
+	for (r = (struct log_ring *)ATOM_LOAD(&w->ring); r; r = r->next) {
+		drain_ring(w, b, r);
+	}
+	batch_flush(w, b);
+}
+
+static int
+file_open(struct logwriter *w) {
+	w->fd = open(w->filename, O_WRONLY | O_APPEND | O_CREAT, 0644);
+	if (w->fd < 0) {
+		return 1;
+	}
+	struct stat st;
+	w->file_size = fstat(w->fd, &st) == 0 ? st.st_size : 0;
+	w->file_time = w->starttime + skynet_now() / 100;
+	return 0;
+}
+
+static void
+file_reopen(struct logwriter *w) {
+	int fd = w->fd;
+	if (file_open(w)) {
+		// keep the old one
+		w->fd = fd;
+		return;
+	}
+	close(fd);
+}
+
+// Rename the file to filename.YYYYmmdd-HHMMSS (.N if it rotates more than once in a second) and open a new one
+static void
+file_rotate(struct logwriter *w, time_t now) {
+	size_t sz = strlen(w->filename);
+	char tmp[sz + 48];
+	struct tm info;
+	(void)localtime_r(&now, &info);
+	memcpy(tmp, w->filename, sz);
+	size_t len = sz + strftime(tmp + sz, 32, ".%Y%m%d-%H%M%S", &info);
+	int i;
+	for (i=1; access(tmp, F_OK) == 0; i++) {
+		sprintf(tmp + len, ".%d", i);
+	}
+	if (rename(w->filename, tmp) == 0) {
+		file_reopen(w);
+	}
+}
+
+static void
+check_file(struct logwriter *w) {
+	if (w->filename == NULL)
+		return;
+	if (ATOM_LOAD(&w->reopen)) {
+		ATOM_STORE(&w->reopen, 0);
+		file_reopen(w);
+	}
+	time_t now = w->starttime + skynet_now() / 100;
+	if (w->rotate_size > 0 && w->file_size >= w->rotate_size) {
+		file_rotate(w, now);
+	} else if (w->rotate_time > 0 && now / w->rotate_time != w->file_time / w->rotate_time) {
+		file_rotate(w, now);
+	}
+}
+
+static void *
+thread_writer(void *p) {
+	struct logwriter *w = p;
+	while (!ATOM_LOAD(&w->quit)) {
+		drain(w);
+		check_file(w);
+		ATOM_STORE(&w->p.state, WRITER_SLEEP);
+		park_wait_timeout(&w->p, WRITER_SLEEP, w->flush);
+		ATOM_STORE(&w->p.state, WRITER_AWAKE);
+	}
+	drain(w);
+	return NULL;
+}
+
+int
+skynet_logwriter_init(const char *filename, int buffer, int flush, size_t rotate_size, int rotate_time) {
+	struct logwriter *w = skynet_malloc(sizeof(*w));
+	memset(w, 0, sizeof(*w));
+	size_t cap = MIN_RING_SIZE;
+	while (cap < (size_t)buffer) {
+		cap *= 2;
+	}
+	w->ring_size = cap;
+	w->flush = (flush > 0 ? flush : 1) * 1000;
+	w->rotate_size = rotate_size;
+	w->rotate_time = rotate_time;
+	w->starttime = skynet_starttime();
+	w->last_sec = -1;
+	if (filename) {
+		w->filename = skynet_malloc(strlen(filename) + 1);
+		strcpy(w->filename, filename);
+		if (file_open(w)) {
+			fprintf(stderr, "Can't open log file %s\n", filename);
+			skynet_free(w->filename);
+			skynet_free(w);
+			return 1;
+		}
+	} else {
+		w->fd = STDOUT_FILENO;
+	}
+	if (pthread_key_create(&w->ring_key, ring_exit)) {
+		fprintf(stderr, "pthread_key_create failed");
+		exit(1);
+	}
+	ATOM_INIT(&w->ring, 0);
+	ATOM_INIT(&w->reopen, 0);
+	ATOM_INIT(&w->quit, 0);
+	park_init(&w->p, WRITER_AWAKE);
+	if (pthread_create(&w->thread, NULL, thread_writer, w)) {
+		fprintf(stderr, "Create thread failed");
+		exit(1);
+	}
+	W = w;
+	return 0;
+}
+
+void
+skynet_logwriter_exit(void) {
+	struct logwriter *w = W;
+	if (w == NULL)
+		return;
+	ATOM_STORE(&w->quit, 1);
+	ATOM_STORE(&w->p.state, WRITER_AWAKE);
+	park_wake(&w->p);
+	pthread_join(w->thread, NULL);
+	// the rings are kept, other threads may still log after exit, they are dropped silently
+}
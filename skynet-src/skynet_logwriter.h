@@ -0,0 +1,23 @@
+#ifndef skynet_logwriter_h
+#define skynet_logwriter_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Asynchronous logger for skynet_error. Each thread appends lines to its own ring buffer,
+// and a writer thread drains all of them with writev.
+
+// filename NULL means stdout. buffer is the ring size of each thread in bytes, flush is the max delay in millisecond.
+// The file is rotated when it grows over rotate_size bytes or every rotate_time seconds, 0 means never.
+int skynet_logwriter_init(const char *filename, int buffer, int flush, size_t rotate_size, int rotate_time);
+int skynet_logwriter_enabled(void);
+// returns 0 if the line is dropped because the ring of current thread is full
+int skynet_logwriter_push(uint32_t source, const char *msg, size_t sz);
+// reopen the file at next flush, for SIGHUP
+void skynet_logwriter_reopen(void);
+// total lines dropped since start
+size_t skynet_logwriter_dropped(void);
+// flush all the lines and stop the writer thread
+void skynet_logwriter_exit(void);
+
+#endif
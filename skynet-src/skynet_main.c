@@ -168,13 +168,31 @@ main(int argc, char *argv[]) {
 
     // 从配置虚拟机中读取一些基础配置，如果没有配置，则设置默认值
 	config.thread =  optint("thread",8);
+	config.socket_thread = optint("socket_thread", 1);
+	config.socket_uring = optboolean("socket_uring", 0);
+	config.socket_readpool = optboolean("socket_readpool", 0);
 	config.module_path = optstring("cpath","./cservice/?.so");
 	config.harbor = optint("harbor", 1);
 	config.bootstrap = optstring("bootstrap","snlua bootstrap");
 	config.daemon = optstring("daemon", NULL);
 	config.logger = optstring("logger", NULL);
 	config.logservice = optstring("logservice", "logger");
+	config.logasync = optboolean("logasync", 0);
+	config.logbuffer = optint("logbuffer", 65536);
+	config.logflush = optint("logflush", 100);
+	config.logrotate_size = optint("logrotate_size", 0);
+	config.logrotate_time = optint("logrotate_time", 0);
 	config.profile = optboolean("profile", 1);
+	config.latency = optboolean("latency", 0);
+	config.timer_precision = optint("timer_precision", 10);
+	config.timer_event = optboolean("timer_event", 0);
+	config.slow_threshold = optint("slow_threshold", 0);
+	config.timeslice = optint("timeslice", 1000);
+	config.spin = optint("worker_spin", 64);
+	config.affinity_worker = optstring("affinity_worker", NULL);
+	config.affinity_socket = optstring("affinity_socket", NULL);
+	config.affinity_timer = optstring("affinity_timer", NULL);
+	config.affinity_monitor = optstring("affinity_monitor", NULL);
 
 	skynet_start(&config);
 	skynet_globalexit();
@@ -2,19 +2,29 @@
 
 #include "skynet_monitor.h"
 #include "skynet_server.h"
+#include "skynet_timer.h"
 #include "skynet.h"
 #include "atomic.h"
 
 #include <stdlib.h>
 #include <string.h>
 
+// signal 2 makes snlua log the traceback of the running code
+#define SIGNAL_TRACEBACK 2
+
+// The version is odd while a message is dispatching.
 struct skynet_monitor {
 	ATOM_INT version;
 	int check_version;
 	uint32_t source;
 	uint32_t destination;
+	int type;
+	uint64_t start;	// in microsec, only when the slow message check is on
+	ATOM_INT slow;	// the version of the message reported slow
 };
 
+static int SLOW_THRESHOLD = 0;	// in microsec
+
 struct skynet_monitor * 
 skynet_monitor_new() {
 	struct skynet_monitor * ret = skynet_malloc(sizeof(*ret));
@@ -29,7 +39,18 @@ skynet_monitor_delete(struct skynet_monitor *sm) {
 
 // 分发消息时调用，提升版本号
 void 
-skynet_monitor_trigger(struct skynet_monitor *sm, uint32_t source, uint32_t destination) {
+skynet_monitor_trigger(struct skynet_monitor *sm, uint32_t source, uint32_t destination, int type) {
+	if (SLOW_THRESHOLD > 0) {
+		if (destination) {
+			sm->type = type;
+			sm->start = skynet_monotonic_time();
+		} else if (ATOM_LOAD(&sm->slow) == ATOM_LOAD(&sm->version)) {
+			// the monitor thread has reported it, log the whole time
+			uint64_t cost = skynet_monotonic_time() - sm->start;
+			skynet_error(NULL, "slow: A message from [ :%08x ] to [ :%08x ] type %d costs %.3fms",
+				sm->source, sm->destination, sm->type, (double)cost / 1000.0);
+		}
+	}
 	sm->source = source;
 	sm->destination = destination;
 	ATOM_FINC(&sm->version);
@@ -48,3 +69,48 @@ skynet_monitor_check(struct skynet_monitor *sm) {
 		sm->check_version = sm->version;
 	}
 }
+
+void
+skynet_monitor_slow_threshold(int threshold) {
+	SLOW_THRESHOLD = threshold > 0 ? threshold * 1000 : 0;
+}
+
+int
+skynet_monitor_slow_interval(void) {
+	if (SLOW_THRESHOLD == 0) {
+		return 0;
+	}
+	// check twice in a threshold, between 1ms and 1s
+	int interval = SLOW_THRESHOLD / 2;
+	if (interval < 1000) {
+		interval = 1000;
+	} else if (interval > 1000000) {
+		interval = 1000000;
+	}
+	return interval;
+}
+
+// The monitor thread calls it every skynet_monitor_slow_interval(), report a message once when it runs over the threshold
+void
+skynet_monitor_check_slow(struct skynet_monitor *sm) {
+	int version = ATOM_LOAD(&sm->version);
+	if ((version & 1) == 0 || ATOM_LOAD(&sm->slow) == version) {
+		return;
+	}
+	uint64_t start = sm->start;
+	uint32_t source = sm->source;
+	uint32_t destination = sm->destination;
+	int type = sm->type;
+	if (ATOM_LOAD(&sm->version) != version) {
+		// the worker has moved on while reading
+		return;
+	}
+	uint64_t cost = skynet_monotonic_time() - start;
+	if (cost < (uint64_t)SLOW_THRESHOLD) {
+		return;
+	}
+	ATOM_STORE(&sm->slow, version);
+	skynet_error(NULL, "slow: A message from [ :%08x ] to [ :%08x ] type %d runs over %dms",
+		source, destination, type, (int)(cost / 1000));
+	skynet_context_signal(destination, SIGNAL_TRACEBACK);
+}
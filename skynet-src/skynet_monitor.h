@@ -7,7 +7,13 @@ struct skynet_monitor;
 
 struct skynet_monitor * skynet_monitor_new();
 void skynet_monitor_delete(struct skynet_monitor *);
-void skynet_monitor_trigger(struct skynet_monitor *, uint32_t source, uint32_t destination);
+void skynet_monitor_trigger(struct skynet_monitor *, uint32_t source, uint32_t destination, int type);
 void skynet_monitor_check(struct skynet_monitor *);
 
+// threshold is in millisecond, 0 turns off the slow message check
+void skynet_monitor_slow_threshold(int threshold);
+// how often (microsec) skynet_monitor_check_slow should be called, 0 if it's off
+int skynet_monitor_slow_interval(void);
+void skynet_monitor_check_slow(struct skynet_monitor *);
+
 #endif
@@ -1,97 +1,396 @@
 #include "skynet.h"
 #include "skynet_mq.h"
 #include "skynet_handle.h"
+#include "skynet_timer.h"
 #include "spinlock.h"
+#include "atomic.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 #include <stdbool.h>
+#include <pthread.h>
 
-#define DEFAULT_QUEUE_SIZE 64
+#define DEFAULT_QUEUE_SIZE 32
 #define MAX_GLOBAL_MQ 0x10000
 
+// The message queue is a list of blocks, each block has DEFAULT_QUEUE_SIZE slots.
+// A slot is 64 bytes with the enqueue stamp and the inline payload buffer.
+// An index is (lap * MQ_LAP + offset), offset MQ_BLOCK_CAP means the next block is being installed.
+#define MQ_BLOCK_CAP DEFAULT_QUEUE_SIZE
+#define MQ_LAP (MQ_BLOCK_CAP + 1)
+
+// Each worker owns a local run queue, the global queue is only used for
+// injection from non-worker threads (socket, timer) and for overflow.
+#define LOCAL_QUEUE_SIZE 256
+// Check the global queue first every N pops, so injected queues can't starve.
+#define GLOBAL_CHECK_INTERVAL 61
+// Every N pops, skip the high priority queues once, so they can't starve the others.
+#define HIGH_YIELD_INTERVAL 8
+// Check the low priority queues first every N pops.
+#define LOW_CHECK_INTERVAL 31
+
 // 0 means mq is not in global mq.
 // 1 means mq is in global mq , or the message is dispatching.
 
 #define MQ_IN_GLOBAL 1
 #define MQ_OVERLOAD 1024
 
+struct mq_slot {
+	struct skynet_message msg;
+	ATOM_INT ready;
+	uint32_t stamp;	// enqueue time in microsec (low 32 bits), if STAMP is on
+	char payload[MESSAGE_INLINE_SIZE + 1];	// for MESSAGE_TAG_INLINE
+};
+
+struct mq_block {
+	ATOM_POINTER next;
+	struct mq_slot slot[MQ_BLOCK_CAP];
+};
+
+// Multi-producer single-consumer queue, producers never take a lock.
+// Only the worker which owns the queue (in_global) pops from it.
 struct message_queue {
-	struct spinlock lock;
+	// producer side
+	ATOM_SIZET tail;
+	ATOM_POINTER tail_block;
+	ATOM_POINTER spare;	// a recycled block for the next producer which needs it
+	// consumer side
+	size_t head;
+	struct mq_block *head_block;
+	struct mq_block *retired;	// the last inline message popped may still point into it
+	uint32_t stamp;	// enqueue time of the last message popped
+	int capacity;	// 0 means unlimited
+	ATOM_SIZET shared_head;	// head for producers, only updated when capacity is set
 	uint32_t handle;
-	int cap;
-	int head;
-	int tail;
-	int release;
-	int in_global; // 这个字段是什么含义
+	ATOM_INT priority;	// set by PRIORITY command from any thread
+	ATOM_INT release;
+	ATOM_INT in_global; // 这个字段是什么含义
 	int overload;  // 记录当前消息队列的负载，用来告警
 	int overload_threshold;
-	struct skynet_message *queue;
 	struct message_queue *next;
 };
 
-// 全局队列的列表成员是消息队列
-struct global_queue {
+// 每个 worker 线程私有的运行队列，其他 worker 空闲时可以从这里偷取
+struct local_queue {
+	struct spinlock lock;
+	unsigned head;
+	unsigned tail;
+	unsigned tick;
+	unsigned seed;
+	struct message_queue *queue[LOCAL_QUEUE_SIZE];
+};
+
+struct mq_list {
+	struct spinlock lock;
 	struct message_queue *head;
 	struct message_queue *tail;
-	struct spinlock lock;
+	ATOM_INT size;
+};
+
+// 全局队列的列表成员是消息队列
+// Each priority class has a list, normal queues are in the local queues,
+// list[MQ_PRIORITY_NORMAL] is only for injection and overflow.
+struct global_queue {
+	struct mq_list list[MQ_PRIORITY_COUNT];
+	int worker;
+	struct local_queue *local;
+	pthread_key_t local_key;
 };
 
 static struct global_queue *Q = NULL;
+static int STAMP = 0;
+
+static inline struct local_queue *
+current_local(struct global_queue *q) {
+	return (struct local_queue *)pthread_getspecific(q->local_key);
+}
+
+// link the chain [head, tail] of n queues to the list
+static void
+globalmq_push_chain(struct mq_list *list, struct message_queue *head, struct message_queue *tail, int n) {
+	SPIN_LOCK(list)
+	assert(tail->next == NULL);
+	if(list->tail) {
+		list->tail->next = head;
+		list->tail = tail;
+	} else {
+		list->head = head;
+		list->tail = tail;
+	}
+	ATOM_STORE(&list->size, ATOM_LOAD(&list->size) + n);
+	SPIN_UNLOCK(list)
+}
+
+// pop a fair share (at most max) of queues from the list of global queue,
+// return the first one and put the others into l
+static struct message_queue *
+globalmq_grab(struct global_queue *q, struct mq_list *list, struct local_queue *l, int max) {
+	struct message_queue *mq;
+	if (ATOM_LOAD(&list->size) == 0) {
+		return NULL;
+	}
+	SPIN_LOCK(list)
+	mq = list->head;
+	if (mq == NULL) {
+		SPIN_UNLOCK(list)
+		return NULL;
+	}
+	int size = ATOM_LOAD(&list->size);
+	int n = size / q->worker + 1;
+	if (n > size) {
+		n = size;
+	}
+	if (n > max) {
+		n = max;
+	}
+	ATOM_STORE(&list->size, size - n);
+	struct message_queue *last = mq;
+	int i;
+	for (i=1;i<n;i++) {
+		last = last->next;
+	}
+	list->head = last->next;
+	if (list->head == NULL) {
+		assert(last == list->tail);
+		list->tail = NULL;
+	}
+	last->next = NULL;
+	SPIN_UNLOCK(list)
+
+	struct message_queue *first = mq;
+	mq = mq->next;
+	first->next = NULL;
+	if (mq) {
+		// only the owner pushes into l, and l is empty here (or has room for n-1 queues)
+		SPIN_LOCK(l)
+		while (mq) {
+			struct message_queue *next = mq->next;
+			mq->next = NULL;
+			assert(l->tail - l->head < LOCAL_QUEUE_SIZE);
+			l->queue[l->tail++ % LOCAL_QUEUE_SIZE] = mq;
+			mq = next;
+		}
+		SPIN_UNLOCK(l)
+	}
+	return first;
+}
+
+static void
+local_push(struct global_queue *q, struct local_queue *l, struct message_queue *queue) {
+	SPIN_LOCK(l)
+	if (l->tail - l->head < LOCAL_QUEUE_SIZE) {
+		l->queue[l->tail++ % LOCAL_QUEUE_SIZE] = queue;
+		SPIN_UNLOCK(l)
+		return;
+	}
+	// local queue is full, move half of it (and the new one) to the global queue
+	int n = LOCAL_QUEUE_SIZE / 2;
+	struct message_queue *head = l->queue[l->head++ % LOCAL_QUEUE_SIZE];
+	struct message_queue *tail = head;
+	int i;
+	for (i=1;i<n;i++) {
+		struct message_queue *mq = l->queue[l->head++ % LOCAL_QUEUE_SIZE];
+		tail->next = mq;
+		tail = mq;
+	}
+	SPIN_UNLOCK(l)
+	tail->next = queue;
+	globalmq_push_chain(&q->list[MQ_PRIORITY_NORMAL], head, queue, n + 1);
+}
+
+static struct message_queue *
+local_pop(struct local_queue *l) {
+	struct message_queue *mq = NULL;
+	SPIN_LOCK(l)
+	if (l->head != l->tail) {
+		mq = l->queue[l->head++ % LOCAL_QUEUE_SIZE];
+	}
+	SPIN_UNLOCK(l)
+	return mq;
+}
+
+// steal half of the queues from another worker, return one of them
+static struct message_queue *
+local_steal(struct global_queue *q, struct local_queue *l) {
+	struct message_queue *tmp[LOCAL_QUEUE_SIZE / 2];
+	int n = q->worker;
+	l->seed = l->seed * 1103515245 + 12345;
+	int start = (int)((l->seed >> 16) % n);
+	int i;
+	for (i=0;i<n;i++) {
+		struct local_queue *victim = &q->local[(start + i) % n];
+		if (victim == l)
+			continue;
+		SPIN_LOCK(victim)
+		unsigned size = victim->tail - victim->head;
+		unsigned steal = size - size / 2;
+		unsigned j;
+		for (j=0;j<steal;j++) {
+			tmp[j] = victim->queue[victim->head++ % LOCAL_QUEUE_SIZE];
+		}
+		SPIN_UNLOCK(victim)
+		if (steal > 0) {
+			if (steal > 1) {
+				SPIN_LOCK(l)
+				for (j=1;j<steal;j++) {
+					assert(l->tail - l->head < LOCAL_QUEUE_SIZE);
+					l->queue[l->tail++ % LOCAL_QUEUE_SIZE] = tmp[j];
+				}
+				SPIN_UNLOCK(l)
+			}
+			return tmp[0];
+		}
+	}
+	return NULL;
+}
 
 void 
 skynet_globalmq_push(struct message_queue * queue) {
 	struct global_queue *q= Q;
 
-	SPIN_LOCK(q)
 	assert(queue->next == NULL);
-	if(q->tail) {
-		q->tail->next = queue;
-		q->tail = queue;
+	int priority = ATOM_LOAD(&queue->priority);
+	if (priority != MQ_PRIORITY_NORMAL) {
+		globalmq_push_chain(&q->list[priority], queue, queue, 1);
+		return;
+	}
+	struct local_queue *l = current_local(q);
+	if (l) {
+		local_push(q, l, queue);
 	} else {
-		q->head = q->tail = queue;
+		// push from socket/timer/main thread
+		globalmq_push_chain(&q->list[MQ_PRIORITY_NORMAL], queue, queue, 1);
 	}
-	SPIN_UNLOCK(q)
 }
 
-// 将全局队列的头部消息队列移除
+// 优先取高优先级队列，然后从本线程的运行队列取，其次是全局队列，再从其他 worker 偷取，最后是低优先级队列
 struct message_queue * 
 skynet_globalmq_pop() {
 	struct global_queue *q = Q;
-
-	SPIN_LOCK(q)
-	struct message_queue *mq = q->head;
-	if(mq) {
-		q->head = mq->next;
-		if(q->head == NULL) {
-			assert(mq == q->tail);
-			q->tail = NULL;
+	struct mq_list *high = &q->list[MQ_PRIORITY_HIGH];
+	struct mq_list *normal = &q->list[MQ_PRIORITY_NORMAL];
+	struct mq_list *low = &q->list[MQ_PRIORITY_LOW];
+	struct local_queue *l = current_local(q);
+	struct message_queue *mq;
+
+	if (l == NULL) {
+		int i;
+		for (i=0;i<MQ_PRIORITY_COUNT;i++) {
+			mq = globalmq_grab(q, &q->list[i], NULL, 1);
+			if (mq)
+				return mq;
 		}
-		mq->next = NULL;
+		return NULL;
 	}
-	SPIN_UNLOCK(q)
 
-	return mq;
+	unsigned tick = ++l->tick;
+	if (tick % HIGH_YIELD_INTERVAL != 0) {
+		mq = globalmq_grab(q, high, NULL, 1);
+		if (mq)
+			return mq;
+	}
+	if (tick % LOW_CHECK_INTERVAL == 0) {
+		mq = globalmq_grab(q, low, NULL, 1);
+		if (mq)
+			return mq;
+	}
+	if (tick % GLOBAL_CHECK_INTERVAL == 0) {
+		mq = globalmq_grab(q, normal, l, 1);
+		if (mq)
+			return mq;
+	}
+	mq = local_pop(l);
+	if (mq)
+		return mq;
+	mq = globalmq_grab(q, normal, l, LOCAL_QUEUE_SIZE / 2);
+	if (mq)
+		return mq;
+	mq = local_steal(q, l);
+	if (mq)
+		return mq;
+	// high priority queues skipped in this turn
+	mq = globalmq_grab(q, high, NULL, 1);
+	if (mq)
+		return mq;
+	return globalmq_grab(q, low, NULL, 1);
+}
+
+// There are queues other workers can take, for waking up the idle workers.
+int
+skynet_globalmq_surplus(void) {
+	struct global_queue *q = Q;
+	int i;
+	for (i=0;i<MQ_PRIORITY_COUNT;i++) {
+		if (ATOM_LOAD(&q->list[i].size) > 0)
+			return 1;
+	}
+	struct local_queue *l = current_local(q);
+	return l && l->tail != l->head;
+}
+
+void
+skynet_globalmq_worker(int id) {
+	struct global_queue *q = Q;
+	assert(id >= 0 && id < q->worker);
+	pthread_setspecific(q->local_key, &q->local[id]);
+}
+
+static struct mq_block *
+block_new(void) {
+	struct mq_block *b = skynet_malloc(sizeof(*b));
+	int i;
+	ATOM_INIT(&b->next, (uintptr_t)NULL);
+	for (i=0;i<MQ_BLOCK_CAP;i++) {
+		ATOM_INIT(&b->slot[i].ready, 0);
+	}
+	return b;
+}
+
+static struct mq_block *
+block_alloc(struct message_queue *q) {
+	struct mq_block *b = (struct mq_block *)ATOM_LOAD(&q->spare);
+	if (b && ATOM_CAS_POINTER(&q->spare, (uintptr_t)b, (uintptr_t)NULL)) {
+		return b;
+	}
+	return block_new();
+}
+
+static void
+block_free(struct message_queue *q, struct mq_block *b) {
+	int i;
+	ATOM_STORE(&b->next, (uintptr_t)NULL);
+	for (i=0;i<MQ_BLOCK_CAP;i++) {
+		ATOM_STORE(&b->slot[i].ready, 0);
+	}
+	if (!ATOM_CAS_POINTER(&q->spare, (uintptr_t)NULL, (uintptr_t)b)) {
+		skynet_free(b);
+	}
 }
 
 struct message_queue * 
 skynet_mq_create(uint32_t handle) {
 	struct message_queue *q = skynet_malloc(sizeof(*q));
+	struct mq_block *b = block_new();
 	q->handle = handle;
-	q->cap = DEFAULT_QUEUE_SIZE;
+	ATOM_INIT(&q->priority, MQ_PRIORITY_NORMAL);
+	ATOM_INIT(&q->tail, 0);
+	ATOM_INIT(&q->tail_block, (uintptr_t)b);
+	ATOM_INIT(&q->spare, (uintptr_t)NULL);
 	q->head = 0;
-	q->tail = 0;
-	SPIN_INIT(q)
+	q->head_block = b;
+	q->retired = NULL;
+	q->stamp = 0;
+	q->capacity = 0;
+	ATOM_INIT(&q->shared_head, 0);
 	// When the queue is create (always between service create and service init) ,
 	// set in_global flag to avoid push it to global queue .
 	// If the service init success, skynet_context_new will call skynet_mq_push to push it to global queue.
-	q->in_global = MQ_IN_GLOBAL;
-	q->release = 0;
+	ATOM_INIT(&q->in_global, MQ_IN_GLOBAL);
+	ATOM_INIT(&q->release, 0);
 	q->overload = 0;
 	q->overload_threshold = MQ_OVERLOAD;
-	q->queue = skynet_malloc(sizeof(struct skynet_message) * q->cap);
 	q->next = NULL;
 
 	return q;
@@ -100,8 +399,14 @@ skynet_mq_create(uint32_t handle) {
 static void 
 _release(struct message_queue *q) {
 	assert(q->next == NULL);
-	SPIN_DESTROY(q)
-	skynet_free(q->queue);
+	struct mq_block *b = q->head_block;
+	while (b) {
+		struct mq_block *next = (struct mq_block *)ATOM_LOAD(&b->next);
+		skynet_free(b);
+		b = next;
+	}
+	skynet_free(q->retired);
+	skynet_free((void *)ATOM_LOAD(&q->spare));
 	skynet_free(q);
 }
 
@@ -110,21 +415,67 @@ skynet_mq_handle(struct message_queue *q) {
 	return q->handle;
 }
 
+// The new priority takes effect next time q is pushed into global queue.
+void
+skynet_mq_priority(struct message_queue *q, int priority) {
+	assert(priority >= 0 && priority < MQ_PRIORITY_COUNT);
+	ATOM_STORE(&q->priority, priority);
+}
+
+int
+skynet_mq_getpriority(struct message_queue *q) {
+	return ATOM_LOAD(&q->priority);
+}
+
+void
+skynet_mq_stamp_enable(int enable) {
+	STAMP = enable;
+}
+
+uint32_t
+skynet_mq_stamp(struct message_queue *q) {
+	return q->stamp;
+}
+
+// the number of slots before index
+static inline size_t
+index_count(size_t index) {
+	size_t offset = index % MQ_LAP;
+	return index / MQ_LAP * MQ_BLOCK_CAP + (offset < MQ_BLOCK_CAP ? offset : MQ_BLOCK_CAP);
+}
+
 // 获取消息队列的长度
+// It counts the messages in pushing, and only the consumer can call it.
 int
 skynet_mq_length(struct message_queue *q) {
-	int head, tail,cap;
+	size_t tail = ATOM_LOAD(&q->tail);
+	return (int)(index_count(tail) - index_count(q->head));
+}
 
-	SPIN_LOCK(q)
-	head = q->head;
-	tail = q->tail;
-	cap = q->cap;
-	SPIN_UNLOCK(q)
-	
-	if (head <= tail) {
-		return tail - head;
-	}
-	return tail + cap - head;
+// Only the consumer can set the capacity.
+void
+skynet_mq_capacity(struct message_queue *q, int capacity) {
+	ATOM_STORE(&q->shared_head, q->head);
+	q->capacity = capacity;
+}
+
+int
+skynet_mq_getcapacity(struct message_queue *q) {
+	return q->capacity;
+}
+
+// The producers can call it, the length is approximate, and it's valid only if the capacity is set.
+int
+skynet_mq_pending(struct message_queue *q) {
+	size_t tail = ATOM_LOAD(&q->tail);
+	size_t head = ATOM_LOAD(&q->shared_head);
+	return (int)(index_count(tail) - index_count(head));
+}
+
+int
+skynet_mq_full(struct message_queue *q) {
+	int capacity = q->capacity;
+	return capacity && skynet_mq_pending(q) >= capacity;
 }
 
 // 返回消息队列的 overload，并将队列的 overload 设置为 0
@@ -138,107 +489,193 @@ skynet_mq_overload(struct message_queue *q) {
 	return 0;
 }
 
+// try to take the ownership of q, return 1 if the caller should push it into global queue
+static inline int
+mq_acquire(struct message_queue *q) {
+	while (ATOM_LOAD(&q->in_global) == 0) {
+		if (ATOM_CAS(&q->in_global, 0, MQ_IN_GLOBAL))
+			return 1;
+	}
+	return 0;
+}
+
+static int
+mq_take(struct message_queue *q, struct skynet_message *message) {
+	struct mq_block *b = q->head_block;
+	int offset = q->head % MQ_LAP;
+	struct mq_slot *slot = &b->slot[offset];
+	if (!ATOM_LOAD(&slot->ready)) {
+		// empty, or the producer has not finished writing yet
+		return 1;
+	}
+	*message = slot->msg;
+	q->stamp = slot->stamp;
+	if (message->sz & MESSAGE_TAG_INLINE) {
+		message->data = slot->payload;
+	}
+	if (offset + 1 == MQ_BLOCK_CAP) {
+		// the producer of the last slot installs next block before writing the slot
+		struct mq_block *next = (struct mq_block *)ATOM_LOAD(&b->next);
+		assert(next);
+		q->head_block = next;
+		q->head += 2;
+		// no producer touches b after all slots are ready,
+		// but keep it until next pop because of the inline payload.
+		q->retired = b;
+	} else {
+		q->head++;
+	}
+	if (q->capacity) {
+		ATOM_STORE(&q->shared_head, q->head);
+	}
+	return 0;
+}
+
 // 从 queue 中取出一条消息存到 message 中
 int
 skynet_mq_pop(struct message_queue *q, struct skynet_message *message) {
-	int ret = 1;
-	SPIN_LOCK(q)
-
-	if (q->head != q->tail) {
-        // head != tail 说明有消息在队列中
-        // 这里从队列头取一条消息到 message
-		*message = q->queue[q->head++];
-		ret = 0;
-		int head = q->head;
-		int tail = q->tail;
-		int cap = q->cap;
-
-		if (head >= cap) {
-			q->head = head = 0;
-		}
-        // 计算队列中剩余消息数量
-		int length = tail - head;
-		if (length < 0) {
-			length += cap;
-		}
-        // 更新队列的 overload 和 overload_threshold
+	if (q->retired) {
+		block_free(q, q->retired);
+		q->retired = NULL;
+	}
+	if (mq_take(q, message) == 0) {
+        // 计算队列中剩余消息数量，更新队列的 overload 和 overload_threshold
+		int length = skynet_mq_length(q);
 		while (length > q->overload_threshold) {
 			q->overload = length;
 			q->overload_threshold *= 2;
 		}
-	} else {
-        // 队列为空，重置 overload_threshold
-		// reset overload_threshold when queue is empty
-		q->overload_threshold = MQ_OVERLOAD;
+		return 0;
 	}
+    // 队列为空，重置 overload_threshold
+	// reset overload_threshold when queue is empty
+	q->overload_threshold = MQ_OVERLOAD;
 
-    // TODO 这里的目的是什么
-	if (ret) {
-		q->in_global = 0;
+	// Give up the ownership, then check again : a producer may push a message
+	// after mq_take and see in_global set, it wouldn't push q into global queue.
+	ATOM_STORE(&q->in_global, 0);
+	if (ATOM_LOAD(&q->head_block->slot[q->head % MQ_LAP].ready) && mq_acquire(q)) {
+		return mq_take(q, message);
 	}
-	
-	SPIN_UNLOCK(q)
-
-	return ret;
+	return 1;
 }
 
-// 扩充消息队列容量(每次翻2倍)
-static void
-expand_queue(struct message_queue *q) {
-	struct skynet_message *new_queue = skynet_malloc(sizeof(struct skynet_message) * q->cap * 2);
-	int i;
-	for (i=0;i<q->cap;i++) {
-		new_queue[i] = q->queue[(q->head + i) % q->cap];
+// Claim continuous slots in the tail block for at most n messages with one CAS,
+// returns the number of messages written.
+static int
+mq_put(struct message_queue *q, struct skynet_message *message, int n, struct mq_block **next_block, uint32_t stamp) {
+	size_t tail = ATOM_LOAD(&q->tail);
+	struct mq_block *b = (struct mq_block *)ATOM_LOAD(&q->tail_block);
+
+	for (;;) {
+		int offset = tail % MQ_LAP;
+		if (offset == MQ_BLOCK_CAP) {
+			// another producer is installing the next block
+			atomic_pause_();
+			tail = ATOM_LOAD(&q->tail);
+			b = (struct mq_block *)ATOM_LOAD(&q->tail_block);
+			continue;
+		}
+		int k = n;
+		if (offset + k > MQ_BLOCK_CAP) {
+			k = MQ_BLOCK_CAP - offset;
+		}
+		// the producer which claims the last slot installs the next block
+		int install = (offset + k == MQ_BLOCK_CAP);
+		if (install && *next_block == NULL) {
+			*next_block = block_alloc(q);
+		}
+		if (ATOM_CAS_SIZET(&q->tail, tail, tail + k)) {
+			if (install) {
+				ATOM_STORE(&q->tail_block, (uintptr_t)*next_block);
+				ATOM_STORE(&q->tail, tail + k + 1);
+				ATOM_STORE(&b->next, (uintptr_t)*next_block);
+				*next_block = NULL;
+			}
+			int i;
+			for (i=0;i<k;i++) {
+				struct mq_slot *slot = &b->slot[offset + i];
+				slot->msg = message[i];
+				slot->stamp = stamp;
+				if (slot->msg.sz & MESSAGE_TAG_INLINE) {
+					size_t sz = slot->msg.sz & MESSAGE_TYPE_MASK;
+					assert(sz <= MESSAGE_INLINE_SIZE);
+					memcpy(slot->payload, message[i].data, sz);
+					slot->payload[sz] = '\0';
+					slot->msg.data = NULL;
+				}
+				ATOM_STORE(&slot->ready, 1);
+			}
+			return k;
+		}
+		tail = ATOM_LOAD(&q->tail);
+		b = (struct mq_block *)ATOM_LOAD(&q->tail_block);
 	}
-	q->head = 0;
-	q->tail = q->cap;
-	q->cap *= 2;
-	
-	skynet_free(q->queue);
-	q->queue = new_queue;
 }
 
-// 将一条消息插入消息队列
-void 
-skynet_mq_push(struct message_queue *q, struct skynet_message *message) {
+// 将多条消息插入消息队列，q 最多只会被放入全局队列一次
+void
+skynet_mq_pushv(struct message_queue *q, struct skynet_message *message, int n) {
 	assert(message);
-	SPIN_LOCK(q)
-
-	q->queue[q->tail] = *message;
-	if (++ q->tail >= q->cap) {
-		q->tail = 0;
+	struct mq_block *next_block = NULL;
+	uint32_t stamp = STAMP ? (uint32_t)skynet_monotonic_time() : 0;
+	while (n > 0) {
+		int k = mq_put(q, message, n, &next_block, stamp);
+		message += k;
+		n -= k;
 	}
-
-	if (q->head == q->tail) {
-		expand_queue(q);
+	if (next_block) {
+		block_free(q, next_block);
 	}
 
-	if (q->in_global == 0) {
-		q->in_global = MQ_IN_GLOBAL;
+	if (mq_acquire(q)) {
 		skynet_globalmq_push(q);
 	}
-	
-	SPIN_UNLOCK(q)
 }
 
+// 将一条消息插入消息队列
 void 
-skynet_mq_init() {
+skynet_mq_push(struct message_queue *q, struct skynet_message *message) {
+	skynet_mq_pushv(q, message, 1);
+}
+
+void 
+skynet_mq_init(int worker) {
 	struct global_queue *q = skynet_malloc(sizeof(*q));
 	memset(q,0,sizeof(*q));
-	SPIN_INIT(q);
+	int i;
+	for (i=0;i<MQ_PRIORITY_COUNT;i++) {
+		struct mq_list *list = &q->list[i];
+		SPIN_INIT(list)
+		list->head = NULL;
+		list->tail = NULL;
+		ATOM_INIT(&list->size, 0);
+	}
+	if (pthread_key_create(&q->local_key, NULL)) {
+		fprintf(stderr, "pthread_key_create failed");
+		exit(1);
+	}
+	q->worker = worker;
+	q->local = skynet_malloc(worker * sizeof(struct local_queue));
+	for (i=0;i<worker;i++) {
+		struct local_queue *l = &q->local[i];
+		SPIN_INIT(l)
+		l->head = 0;
+		l->tail = 0;
+		l->tick = 0;
+		l->seed = i + 1;
+	}
 	Q=q;
 }
 
 // 将一个消息队列标记为待释放
 void 
 skynet_mq_mark_release(struct message_queue *q) {
-	SPIN_LOCK(q)
-	assert(q->release == 0);
-	q->release = 1;
-	if (q->in_global != MQ_IN_GLOBAL) {
+	assert(ATOM_LOAD(&q->release) == 0);
+	ATOM_STORE(&q->release, 1);
+	if (mq_acquire(q)) {
 		skynet_globalmq_push(q);
 	}
-	SPIN_UNLOCK(q)
 }
 
 // 释放一个消息队列中的所有消息
@@ -253,14 +690,10 @@ _drop_queue(struct message_queue *q, message_drop drop_func, void *ud) {
 
 void 
 skynet_mq_release(struct message_queue *q, message_drop drop_func, void *ud) {
-	SPIN_LOCK(q)
-	
-	if (q->release) {
-        // TODO 为什么是先 unlock 再 drop
-		SPIN_UNLOCK(q)
+	if (ATOM_LOAD(&q->release)) {
 		_drop_queue(q, drop_func, ud);
 	} else {
+		// q is still owned by this worker (in_global), mark_release will find it in global queue
 		skynet_globalmq_push(q);
-		SPIN_UNLOCK(q)
 	}
 }
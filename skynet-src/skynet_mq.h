@@ -12,13 +12,30 @@ struct skynet_message {
 };
 
 // type is encoding in skynet_message.sz high 8bit
-#define MESSAGE_TYPE_MASK (SIZE_MAX >> 8)
+#define MESSAGE_TYPE_MASK (SIZE_MAX >> 9)
 #define MESSAGE_TYPE_SHIFT ((sizeof(size_t)-1) * 8)
 
+// The bit below type marks an inline message : the payload (at most MESSAGE_INLINE_SIZE bytes) is
+// copied into the message queue when pushing, so message.data is not owned by the queue.
+// After skynet_mq_pop, message.data points into the queue, it's valid until next skynet_mq_pop,
+// and the receiver must not free or reserve it.
+#define MESSAGE_TAG_INLINE ((size_t)1 << (MESSAGE_TYPE_SHIFT - 1))
+#define MESSAGE_INLINE_SIZE 31
+
 struct message_queue;
 
+// priority class of message queue, higher class is dispatched first
+#define MQ_PRIORITY_HIGH 0
+#define MQ_PRIORITY_NORMAL 1
+#define MQ_PRIORITY_LOW 2
+#define MQ_PRIORITY_COUNT 3
+
 void skynet_globalmq_push(struct message_queue * queue);
 struct message_queue * skynet_globalmq_pop(void);
+// bind the current thread to the local run queue of worker id
+void skynet_globalmq_worker(int id);
+// returns 1 if the global queue or the local run queue of current worker is not empty
+int skynet_globalmq_surplus(void);
 
 struct message_queue * skynet_mq_create(uint32_t handle);
 void skynet_mq_mark_release(struct message_queue *q);
@@ -27,15 +44,32 @@ typedef void (*message_drop)(struct skynet_message *, void *);
 
 void skynet_mq_release(struct message_queue *q, message_drop drop_func, void *ud);
 uint32_t skynet_mq_handle(struct message_queue *);
+void skynet_mq_priority(struct message_queue *q, int priority);
+int skynet_mq_getpriority(struct message_queue *q);
 
 // 0 for success
 int skynet_mq_pop(struct message_queue *q, struct skynet_message *message);
 void skynet_mq_push(struct message_queue *q, struct skynet_message *message);
+// push n messages together, it's cheaper than n times skynet_mq_push
+void skynet_mq_pushv(struct message_queue *q, struct skynet_message *message, int n);
+
+// record the enqueue time of each message, for profile
+void skynet_mq_stamp_enable(int enable);
+// the enqueue time of the last message popped, in microsec (low 32 bits of skynet_monotonic_time)
+uint32_t skynet_mq_stamp(struct message_queue *q);
 
 // return the length of message queue, for debug
 int skynet_mq_length(struct message_queue *q);
 int skynet_mq_overload(struct message_queue *q);
 
-void skynet_mq_init();
+// bounded message queue, capacity 0 means unlimited.
+// skynet_mq_push never fails, the senders check skynet_mq_full before pushing.
+void skynet_mq_capacity(struct message_queue *q, int capacity);
+int skynet_mq_getcapacity(struct message_queue *q);
+int skynet_mq_full(struct message_queue *q);
+// the length of a bounded message queue, the producers can call it
+int skynet_mq_pending(struct message_queue *q);
+
+void skynet_mq_init(int worker);
 
 #endif
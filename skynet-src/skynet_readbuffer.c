@@ -0,0 +1,265 @@
+#include "skynet.h"
+#include "skynet_readbuffer.h"
+#include "atomic.h"
+#include "spinlock.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The classes are 64 bytes (MIN_READ_BUFFER of socket_server) to 64K, larger buffers are not pooled.
+#define MIN_CLASS_SHIFT 6
+#define CLASS_N 11
+#define NOCLASS CLASS_N
+// buffers of each class in the cache of a thread
+#define CACHE_N 32
+// buffers moved between a cache and the global list at a time
+#define BATCH_N 16
+// bytes of each class in the global list, the buffers over it are freed
+#define GLOBAL_LIMIT (1024 * 1024)
+
+// The header before the buffer, it keeps the buffer aligned as malloc.
+struct block {
+	struct block *next;
+	size_t cls;
+};
+
+// Only the owner thread writes the cache.
+struct cache {
+	struct cache *next;
+	ATOM_INT used;
+	int n[CLASS_N];
+	struct block *slot[CLASS_N][CACHE_N];
+	uint64_t alloc;
+	uint64_t hit;
+};
+
+struct freelist {
+	struct spinlock lock;
+	struct block *head;
+	int n;
+	int limit;
+};
+
+struct readbuffer_pool {
+	pthread_key_t cache_key;
+	ATOM_POINTER cache;	// struct cache * list
+	struct freelist global[CLASS_N];
+};
+
+static struct readbuffer_pool *P = NULL;
+// The buffers have no header when the pool is off, it never changes after init.
+static int ENABLE = 0;
+
+static inline size_t
+class_size(int cls) {
+	return (size_t)1 << (cls + MIN_CLASS_SHIFT);
+}
+
+static int
+size_class(size_t sz) {
+	int cls = 0;
+	while (class_size(cls) < sz) {
+		if (++cls == CLASS_N)
+			return NOCLASS;
+	}
+	return cls;
+}
+
+static void
+cache_exit(void *ud) {
+	struct cache *c = ud;
+	ATOM_STORE(&c->used, 0);
+}
+
+// The cache of current thread, reuse the one left by an exited thread
+static struct cache *
+cache_get(struct readbuffer_pool *p) {
+	struct cache *c = pthread_getspecific(p->cache_key);
+	if (c) {
+		return c;
+	}
+	for (c = (struct cache *)ATOM_LOAD(&p->cache); c; c = c->next) {
+		if (ATOM_LOAD(&c->used) == 0 && ATOM_CAS(&c->used, 0, 1)) {
+			break;
+		}
+	}
+	if (c == NULL) {
+		c = skynet_malloc(sizeof(*c));
+		memset(c, 0, sizeof(*c));
+		ATOM_INIT(&c->used, 1);
+		uintptr_t head;
+		do {
+			head = ATOM_LOAD(&p->cache);
+			c->next = (struct cache *)head;
+		} while (!ATOM_CAS_POINTER(&p->cache, head, (uintptr_t)c));
+	}
+	pthread_setspecific(p->cache_key, c);
+	return c;
+}
+
+// take a batch from the global list, only when the cache of cls is empty
+static void
+cache_refill(struct readbuffer_pool *p, struct cache *c, int cls) {
+	struct freelist *g = &p->global[cls];
+	struct block **slot = c->slot[cls];
+	int n = 0;
+	SPIN_LOCK(g)
+	while (n < BATCH_N && g->head) {
+		slot[n++] = g->head;
+		g->head = g->head->next;
+	}
+	g->n -= n;
+	SPIN_UNLOCK(g)
+	c->n[cls] = n;
+}
+
+// give a batch to the global list, only when the cache of cls is full
+static void
+cache_flush(struct readbuffer_pool *p, struct cache *c, int cls) {
+	struct freelist *g = &p->global[cls];
+	struct block **slot = c->slot[cls];
+	int n = c->n[cls];
+	int i = n - BATCH_N;
+	SPIN_LOCK(g)
+	for (; i < n && g->n < g->limit; i++) {
+		slot[i]->next = g->head;
+		g->head = slot[i];
+		++g->n;
+	}
+	SPIN_UNLOCK(g)
+	for (; i < n; i++) {
+		skynet_free(slot[i]);
+	}
+	c->n[cls] = n - BATCH_N;
+}
+
+void
+skynet_readbuffer_init(int enable) {
+	ENABLE = enable;
+	if (!enable)
+		return;
+	struct readbuffer_pool *p = skynet_malloc(sizeof(*p));
+	if (pthread_key_create(&p->cache_key, cache_exit)) {
+		fprintf(stderr, "pthread_key_create failed");
+		exit(1);
+	}
+	ATOM_INIT(&p->cache, 0);
+	int i;
+	for (i=0;i<CLASS_N;i++) {
+		struct freelist *g = &p->global[i];
+		SPIN_INIT(g)
+		g->head = NULL;
+		g->n = 0;
+		g->limit = GLOBAL_LIMIT / class_size(i);
+		if (g->limit < BATCH_N * 2) {
+			g->limit = BATCH_N * 2;
+		}
+	}
+	P = p;
+}
+
+// Call it after the threads exit, the buffers freed later go back to skynet_free
+void
+skynet_readbuffer_exit(void) {
+	struct readbuffer_pool *p = P;
+	if (p == NULL)
+		return;
+	P = NULL;
+	struct cache *c = (struct cache *)ATOM_LOAD(&p->cache);
+	while (c) {
+		struct cache *next = c->next;
+		int i,j;
+		for (i=0;i<CLASS_N;i++) {
+			for (j=0;j<c->n[i];j++) {
+				skynet_free(c->slot[i][j]);
+			}
+		}
+		skynet_free(c);
+		c = next;
+	}
+	int i;
+	for (i=0;i<CLASS_N;i++) {
+		struct freelist *g = &p->global[i];
+		struct block *b = g->head;
+		while (b) {
+			struct block *next = b->next;
+			skynet_free(b);
+			b = next;
+		}
+		SPIN_DESTROY(g)
+	}
+	pthread_key_delete(p->cache_key);
+	skynet_free(p);
+}
+
+void *
+skynet_readbuffer_alloc(size_t sz) {
+	if (!ENABLE)
+		return skynet_malloc(sz);
+	int cls = size_class(sz);
+	struct readbuffer_pool *p = P;
+	struct block *b = NULL;
+	if (p && cls != NOCLASS) {
+		struct cache *c = cache_get(p);
+		++c->alloc;
+		if (c->n[cls] == 0) {
+			cache_refill(p, c, cls);
+		}
+		if (c->n[cls] > 0) {
+			b = c->slot[cls][--c->n[cls]];
+			++c->hit;
+		}
+	}
+	if (b == NULL) {
+		b = skynet_malloc(sizeof(*b) + (cls == NOCLASS ? sz : class_size(cls)));
+		b->cls = cls;
+	}
+	return b + 1;
+}
+
+void
+skynet_readbuffer_free(void *buffer) {
+	if (buffer == NULL)
+		return;
+	if (!ENABLE) {
+		skynet_free(buffer);
+		return;
+	}
+	struct block *b = (struct block *)buffer - 1;
+	int cls = (int)b->cls;
+	struct readbuffer_pool *p = P;
+	if (p == NULL || cls == NOCLASS) {
+		skynet_free(b);
+		return;
+	}
+	struct cache *c = cache_get(p);
+	if (c->n[cls] == CACHE_N) {
+		cache_flush(p, c, cls);
+	}
+	c->slot[cls][c->n[cls]++] = b;
+}
+
+void
+skynet_readbuffer_stat(struct skynet_readbuffer_stat *stat) {
+	memset(stat, 0, sizeof(*stat));
+	struct readbuffer_pool *p = P;
+	if (p == NULL)
+		return;
+	struct cache *c;
+	int i;
+	for (c = (struct cache *)ATOM_LOAD(&p->cache); c; c = c->next) {
+		stat->alloc += c->alloc;
+		stat->hit += c->hit;
+		for (i=0;i<CLASS_N;i++) {
+			stat->held += c->n[i] * class_size(i);
+		}
+	}
+	for (i=0;i<CLASS_N;i++) {
+		struct freelist *g = &p->global[i];
+		SPIN_LOCK(g)
+		stat->held += g->n * class_size(i);
+		SPIN_UNLOCK(g)
+	}
+}
@@ -0,0 +1,27 @@
+#ifndef skynet_readbuffer_h
+#define skynet_readbuffer_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A size-classed pool of the socket read buffers, the buffer of SKYNET_SOCKET_TYPE_DATA and SKYNET_SOCKET_TYPE_UDP messages.
+// The socket threads allocate them and the services free them in the worker threads,
+// so each thread caches some buffers of each class and exchanges them with a global list in batches.
+// The pool is off unless socket_readpool = true in config, then a buffer is plain skynet_malloc memory.
+// With the pool on, the buffers must be released by skynet_readbuffer_free, not skynet_free or skynet.trash.
+
+struct skynet_readbuffer_stat {
+	uint64_t alloc;	// total allocations
+	uint64_t hit;	// allocations reuse a buffer in the pool
+	size_t held;	// bytes of the buffers in the pool
+};
+
+void skynet_readbuffer_init(int enable);
+void skynet_readbuffer_exit(void);
+void * skynet_readbuffer_alloc(size_t sz);
+// buffer can be NULL
+void skynet_readbuffer_free(void *buffer);
+// the statistics are not exact, the caches of other threads are read without lock
+void skynet_readbuffer_stat(struct skynet_readbuffer_stat *stat);
+
+#endif
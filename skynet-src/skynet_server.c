@@ -10,6 +10,10 @@
 #include "skynet_monitor.h"
 #include "skynet_imp.h"
 #include "skynet_log.h"
+#include "skynet_histogram.h"
+#include "skynet_logwriter.h"
+#include "skynet_readbuffer.h"
+#include "skynet_socket.h"
 #include "spinlock.h"
 #include "atomic.h"
 
@@ -18,9 +22,14 @@
 #include <string.h>
 #include <assert.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdbool.h>
 
+#define DISPATCH_BUDGET_MAX 1024
+#define DISPATCH_TIMESLICE 1000	// in microsec
+#define CPU_AVG_SHIFT 3	// cpu_avg keeps 3 fraction bits
+
 #ifdef CALLING_CHECK
 
 #define CHECKCALLING_BEGIN(ctx) if (!(spinlock_trylock(&ctx->calling))) { assert(0); }
@@ -45,17 +54,26 @@ struct skynet_context {
 	void * cb_ud;
 	skynet_cb cb;
 	struct message_queue *queue;
-	ATOM_POINTER logfile;
+	ATOM_POINTER logfile;	// struct skynet_log *
+	ATOM_INT logoff;	// LOGOFF by another service, the owner closes the logfile before the next message
 	uint64_t cpu_cost;	// in microsec
 	uint64_t cpu_start;	// in microsec
+	uint64_t cpu_avg;	// moving average cost per message, in 1/8 microsec (CPU_AVG_SHIFT)
+	struct skynet_histogram *wait_hist;	// enqueue to dispatch, in microsec, NULL if latency is off
+	struct skynet_histogram *dispatch_hist;	// dispatch duration, in microsec
 	char result[32];
 	uint32_t handle;
 	int session_id;
 	ATOM_INT ref;
 	size_t message_count;
+	int budget;	// messages allowed in the last dispatch turn
 	bool init;
 	bool endless;
 	bool profile;
+	bool inline_msg;	// accept MESSAGE_TAG_INLINE
+	bool full_drop;	// the policy when the mailbox is full, drop or reject
+	ATOM_INT dropped;	// messages dropped or rejected because the mailbox is full
+	ATOM_INT socket_paused;	// some sockets are paused because the mailbox is full
 
 	CHECKCALLING_DECL
 };
@@ -71,6 +89,8 @@ struct skynet_node {
 	uint32_t monitor_exit;
 	pthread_key_t handle_key;
 	bool profile;	// default is on
+	bool latency;	// default is off
+	int timeslice;	// in microsec
 };
 
 static struct skynet_node G_NODE;
@@ -119,7 +139,9 @@ struct drop_t {
 static void
 drop_message(struct skynet_message *msg, void *ud) {
 	struct drop_t *d = ud;
-	skynet_free(msg->data);
+	if (!(msg->sz & MESSAGE_TAG_INLINE)) {
+		skynet_free(msg->data);
+	}
 	uint32_t source = d->handle;
 	assert(source);
 	// report error to the message source
@@ -146,14 +168,28 @@ skynet_context_new(const char * name, const char *param) {
 	ctx->cb_ud = NULL;
 	ctx->session_id = 0;
 	ATOM_INIT(&ctx->logfile, (uintptr_t)NULL);
+	ATOM_INIT(&ctx->logoff, 0);
 
 	ctx->init = false;
 	ctx->endless = false;
 
 	ctx->cpu_cost = 0;
 	ctx->cpu_start = 0;
+	ctx->cpu_avg = 0;
 	ctx->message_count = 0;
+	ctx->budget = 0;
 	ctx->profile = G_NODE.profile;
+	if (G_NODE.latency) {
+		ctx->wait_hist = skynet_histogram_new();
+		ctx->dispatch_hist = skynet_histogram_new();
+	} else {
+		ctx->wait_hist = NULL;
+		ctx->dispatch_hist = NULL;
+	}
+	ctx->inline_msg = false;
+	ctx->full_drop = false;
+	ATOM_INIT(&ctx->dropped, 0);
+	ATOM_INIT(&ctx->socket_paused, 0);
 	// Should set to 0 first to avoid skynet_handle_retireall get an uninitialized handle
 	ctx->handle = 0;	
 	ctx->handle = skynet_handle_register(ctx);
@@ -209,14 +245,32 @@ skynet_context_reserve(struct skynet_context *ctx) {
 	context_dec();
 }
 
+// Only the worker dispatching ctx calls it
+static void
+close_log(struct skynet_context *ctx) {
+	struct skynet_log * log = (struct skynet_log *)ATOM_LOAD(&ctx->logfile);
+	if (log) {
+		if (ATOM_CAS_POINTER(&ctx->logfile, (uintptr_t)log, (uintptr_t)NULL)) {
+			skynet_log_close(ctx, log, ctx->handle);
+		}
+	}
+}
+
 static void 
 delete_context(struct skynet_context *ctx) {
-	FILE *f = (FILE *)ATOM_LOAD(&ctx->logfile);
-	if (f) {
-		fclose(f);
+	struct skynet_log *log = (struct skynet_log *)ATOM_LOAD(&ctx->logfile);
+	if (log) {
+		skynet_log_close(NULL, log, ctx->handle);
 	}
 	skynet_module_instance_release(ctx->mod, ctx->instance);
+	if (ATOM_LOAD(&ctx->socket_paused)) {
+		skynet_socket_resume(ctx->handle);
+	}
 	skynet_mq_mark_release(ctx->queue);
+	if (ctx->wait_hist) {
+		skynet_histogram_delete(ctx->wait_hist);
+		skynet_histogram_delete(ctx->dispatch_hist);
+	}
 	CHECKCALLING_DESTROY(ctx)
 	skynet_free(ctx);
 	context_dec();
@@ -243,6 +297,111 @@ skynet_context_push(uint32_t handle, struct skynet_message *message) {
 	return 0;
 }
 
+// push n messages to the same service once
+int
+skynet_context_pushv(uint32_t handle, struct skynet_message *message, int n) {
+	struct skynet_context * ctx = skynet_handle_grab(handle);
+	if (ctx == NULL) {
+		return -1;
+	}
+	skynet_mq_pushv(ctx->queue, message, n);
+	skynet_context_release(ctx);
+
+	return 0;
+}
+
+int
+skynet_context_push_bounded(uint32_t handle, struct skynet_message *message) {
+	struct skynet_context * ctx = skynet_handle_grab(handle);
+	if (ctx == NULL) {
+		return -1;
+	}
+	skynet_mq_push(ctx->queue, message);
+	int full = skynet_mq_full(ctx->queue);
+	skynet_context_release(ctx);
+
+	return full;
+}
+
+void
+skynet_context_socket_paused(uint32_t handle) {
+	struct skynet_context * ctx = skynet_handle_grab(handle);
+	if (ctx == NULL) {
+		skynet_socket_resume(handle);
+		return;
+	}
+	ATOM_STORE(&ctx->socket_paused, 1);
+	// The owner checks the flag after each pop, but the mailbox may drain before the flag is set.
+	if (skynet_mq_pending(ctx->queue) <= skynet_mq_getcapacity(ctx->queue) / 2
+		&& ATOM_CAS(&ctx->socket_paused, 1, 0)) {
+		skynet_socket_resume(handle);
+	}
+	skynet_context_release(ctx);
+}
+
+// Returns 0 if the message can be pushed. If the mailbox is full, the message should be dropped,
+// returns 1 for drop policy (only for the message without session), or -3 for reject.
+static int
+mailbox_check(struct skynet_context *ctx, struct skynet_message *message) {
+	if (!skynet_mq_full(ctx->queue)) {
+		return 0;
+	}
+	int type = message->sz >> MESSAGE_TYPE_SHIFT;
+	if (type == PTYPE_RESPONSE || type == PTYPE_ERROR) {
+		// never drop the response, or the caller would wait forever
+		return 0;
+	}
+	ATOM_FINC(&ctx->dropped);
+	if (ctx->full_drop && message->session == 0) {
+		return 1;
+	}
+	return -3;
+}
+
+// Push a message for skynet_send, returns 0 on success, -1 for invalid handle or -3 if the mailbox is full.
+// A small message (inline_msg) is copied into the queue if the destination accepts inline message, and
+// if it's owned, the data is freed by the sender thread, not the receiver. Otherwise the data is always owned.
+static int
+context_send(uint32_t handle, struct skynet_message *message, bool inline_msg, bool owned) {
+	bool heap = !inline_msg || owned;
+	struct skynet_context * ctx = skynet_handle_grab(handle);
+	if (ctx == NULL) {
+		if (heap) {
+			skynet_free(message->data);
+		}
+		return -1;
+	}
+	int full = mailbox_check(ctx, message);
+	if (full) {
+		skynet_context_release(ctx);
+		if (heap) {
+			skynet_free(message->data);
+		}
+		return full < 0 ? full : 0;
+	}
+	if (!inline_msg) {
+		skynet_mq_push(ctx->queue, message);
+	} else if (ctx->inline_msg) {
+		message->sz |= MESSAGE_TAG_INLINE;
+		skynet_mq_push(ctx->queue, message);
+		if (owned) {
+			skynet_free(message->data);
+		}
+	} else {
+		if (!owned) {
+			size_t sz = message->sz & MESSAGE_TYPE_MASK;
+			char * msg = skynet_malloc(sz+1);
+			memcpy(msg, message->data, sz);
+			msg[sz] = '\0';
+			message->data = msg;
+		}
+		skynet_mq_push(ctx->queue, message);
+	}
+	skynet_context_release(ctx);
+
+	return 0;
+}
+
 void 
 skynet_context_endless(uint32_t handle) {
 	struct skynet_context * ctx = skynet_handle_grab(handle);
@@ -253,6 +412,17 @@ skynet_context_endless(uint32_t handle) {
 	skynet_context_release(ctx);
 }
 
+// NOTICE: the signal function of the module should be thread safe.
+void
+skynet_context_signal(uint32_t handle, int signal) {
+	struct skynet_context * ctx = skynet_handle_grab(handle);
+	if (ctx == NULL) {
+		return;
+	}
+	skynet_module_instance_signal(ctx->mod, ctx->instance, signal);
+	skynet_context_release(ctx);
+}
+
 int 
 skynet_isremote(struct skynet_context * ctx, uint32_t handle, int * harbor) {
 	int ret = skynet_harbor_message_isremote(handle);
@@ -269,22 +439,45 @@ dispatch_message(struct skynet_context *ctx, struct skynet_message *msg) {
 	pthread_setspecific(G_NODE.handle_key, (void *)(uintptr_t)(ctx->handle));
 	int type = msg->sz >> MESSAGE_TYPE_SHIFT;
 	size_t sz = msg->sz & MESSAGE_TYPE_MASK;
-	FILE *f = (FILE *)ATOM_LOAD(&ctx->logfile);
-	if (f) {
-		skynet_log_output(f, msg->source, type, msg->session, msg->data, sz);
+	void *data = msg->data;
+	bool inline_msg = (msg->sz & MESSAGE_TAG_INLINE) != 0;
+	if (inline_msg && !ctx->inline_msg) {
+		// the callback is changed after the message is sent, it may reserve the message
+		char *copy = skynet_malloc(sz+1);
+		memcpy(copy, data, sz+1);
+		data = copy;
+		inline_msg = false;
+	}
+	if (ATOM_LOAD(&ctx->logoff)) {
+		ATOM_STORE(&ctx->logoff, 0);
+		close_log(ctx);
+	}
+	struct skynet_log *log = (struct skynet_log *)ATOM_LOAD(&ctx->logfile);
+	if (log) {
+		skynet_log_output(log, msg->source, type, msg->session, data, sz);
 	}
 	++ctx->message_count;
+	uint64_t start = 0;
+	if (ctx->wait_hist) {
+		start = skynet_monotonic_time();
+		skynet_histogram_record(ctx->wait_hist, (uint32_t)start - skynet_mq_stamp(ctx->queue));
+	}
 	int reserve_msg;
 	if (ctx->profile) {
 		ctx->cpu_start = skynet_thread_time();
-		reserve_msg = ctx->cb(ctx, ctx->cb_ud, type, msg->session, msg->source, msg->data, sz);
+		reserve_msg = ctx->cb(ctx, ctx->cb_ud, type, msg->session, msg->source, data, sz);
 		uint64_t cost_time = skynet_thread_time() - ctx->cpu_start;
 		ctx->cpu_cost += cost_time;
+		// avg = avg * 7/8 + cost/8, kept in fixed point so the small costs are not truncated to 0
+		ctx->cpu_avg = ctx->cpu_avg - (ctx->cpu_avg >> CPU_AVG_SHIFT) + cost_time;
 	} else {
-		reserve_msg = ctx->cb(ctx, ctx->cb_ud, type, msg->session, msg->source, msg->data, sz);
+		reserve_msg = ctx->cb(ctx, ctx->cb_ud, type, msg->session, msg->source, data, sz);
 	}
-	if (!reserve_msg) {
-		skynet_free(msg->data);
+	if (ctx->wait_hist) {
+		skynet_histogram_record(ctx->dispatch_hist, (uint32_t)(skynet_monotonic_time() - start));
+	}
+	if (!reserve_msg && !inline_msg) {
+		skynet_free(data);
 	}
 	CHECKCALLING_END(ctx)
 }
@@ -299,8 +492,33 @@ skynet_context_dispatchall(struct skynet_context * ctx) {
 	}
 }
 
+// Choose how many messages the service may dispatch in this turn.
+// Expensive services get fewer messages, so they can't hold a worker longer than a time slice.
+static int
+dispatch_budget(struct skynet_context *ctx, int length) {
+	int n = length + 1;	// include the message already popped
+	if (ctx->profile) {
+		if (ctx->cpu_avg > 0) {
+			uint64_t slice = ((uint64_t)G_NODE.timeslice << CPU_AVG_SHIFT) / ctx->cpu_avg;
+			if (n > slice) {
+				n = (int)slice;
+			}
+		}
+	} else {
+		// can't measure the cost, dispatch half of the queue
+		n = n / 2 + 1;
+	}
+	if (n > DISPATCH_BUDGET_MAX) {
+		n = DISPATCH_BUDGET_MAX;
+	} else if (n < 1) {
+		n = 1;
+	}
+	ctx->budget = n;
+	return n;
+}
+
 struct message_queue * 
-skynet_context_message_dispatch(struct skynet_monitor *sm, struct message_queue *q, int weight) {
+skynet_context_message_dispatch(struct skynet_monitor *sm, struct message_queue *q) {
 	if (q == NULL) {
 		q = skynet_globalmq_pop();
 		if (q==NULL)
@@ -318,6 +536,7 @@ skynet_context_message_dispatch(struct skynet_monitor *sm, struct message_queue
 
 	int i,n=1;
 	struct skynet_message msg;
+	uint64_t cpu_cost = ctx->cpu_cost;
 
 	for (i=0;i<n;i++) {
 		if (skynet_mq_pop(q,&msg)) {
@@ -325,25 +544,36 @@ skynet_context_message_dispatch(struct skynet_monitor *sm, struct message_queue
             //
 			skynet_context_release(ctx);
 			return skynet_globalmq_pop();
-		} else if (i==0 && weight >= 0) {
-			n = skynet_mq_length(q);
-			n >>= weight;
+		} else if (i==0) {
+			n = dispatch_budget(ctx, skynet_mq_length(q));
 		}
 		int overload = skynet_mq_overload(q);
 		if (overload) {
 			skynet_error(ctx, "error: May overload, message queue length = %d", overload);
 		}
+		if (ATOM_LOAD(&ctx->socket_paused)
+			&& skynet_mq_length(q) <= skynet_mq_getcapacity(q) / 2
+			&& ATOM_CAS(&ctx->socket_paused, 1, 0)) {
+			skynet_socket_resume(handle);
+		}
 
-		skynet_monitor_trigger(sm, msg.source , handle);
+		skynet_monitor_trigger(sm, msg.source , handle, (int)(msg.sz >> MESSAGE_TYPE_SHIFT));
 
         // 分发从消息队列中取出的消息
 		if (ctx->cb == NULL) {
-			skynet_free(msg.data);
+			if (!(msg.sz & MESSAGE_TAG_INLINE)) {
+				skynet_free(msg.data);
+			}
 		} else {
 			dispatch_message(ctx, &msg);
 		}
 
-		skynet_monitor_trigger(sm, 0,0);
+		skynet_monitor_trigger(sm, 0,0,0);
+
+		// time slice is used up
+		if (ctx->cpu_cost - cpu_cost >= G_NODE.timeslice) {
+			break;
+		}
 	}
 
     // 如果全局队列是非空的，那么就从全局队列头部取出一个新的队列，同时将处理完成的队列
@@ -384,6 +614,11 @@ skynet_queryname(struct skynet_context * context, const char * name) {
 	return 0;
 }
 
+int
+skynet_nameversion(void) {
+	return skynet_handle_nameversion();
+}
+
 static void
 handle_exit(struct skynet_context * context, uint32_t handle) {
 	if (handle == 0) {
@@ -411,11 +646,24 @@ cmd_timeout(struct skynet_context * context, const char * param) {
 	int ti = strtol(param, &session_ptr, 10);
     // TODO 为什么需要增加 session 值
 	int session = skynet_context_newsession(context);
-	skynet_timeout(context->handle, ti, session);
+	if (session_ptr && strcmp(session_ptr, "ms") == 0) {
+		// TIMEOUT 5ms
+		skynet_timeout_ms(context->handle, ti, session);
+	} else {
+		skynet_timeout(context->handle, ti, session);
+	}
 	sprintf(context->result, "%d", session);
 	return context->result;
 }
 
+// returns 1 if the timer of the session is removed before it fires
+static const char *
+cmd_canceltimeout(struct skynet_context * context, const char * param) {
+	int session = strtol(param, NULL, 10);
+	sprintf(context->result, "%d", skynet_timeout_cancel(context->handle, session));
+	return context->result;
+}
+
 static const char *
 cmd_reg(struct skynet_context * context, const char * param) {
 	if (param == NULL || param[0] == '\0') {
@@ -561,6 +809,25 @@ cmd_monitor(struct skynet_context * context, const char * param) {
 	return NULL;
 }
 
+// what is count, max or pN (quantile 0.N, eg. p99, p999), the time is in sec
+static void
+stat_latency(struct skynet_context * context, struct skynet_histogram *h, const char * what) {
+	if (h == NULL) {
+		strcpy(context->result, "0");
+	} else if (strcmp(what, "count") == 0) {
+		sprintf(context->result, "%" PRIu64, skynet_histogram_count(h));
+	} else if (strcmp(what, "max") == 0) {
+		sprintf(context->result, "%lf", (double)skynet_histogram_max(h) / 1000000.0);
+	} else if (what[0] == 'p' && what[1] >= '0' && what[1] <= '9' && strlen(what) < 16) {
+		char tmp[20] = "0.";
+		strcat(tmp, what+1);
+		double q = strtod(tmp, NULL);
+		sprintf(context->result, "%lf", (double)skynet_histogram_quantile(h, q) / 1000000.0);
+	} else {
+		context->result[0] = '\0';
+	}
+}
+
 static const char *
 cmd_stat(struct skynet_context * context, const char * param) {
 	if (strcmp(param, "mqlen") == 0) {
@@ -586,28 +853,61 @@ cmd_stat(struct skynet_context * context, const char * param) {
 		}
 	} else if (strcmp(param, "message") == 0) {
 		sprintf(context->result, "%zu", context->message_count);
+	} else if (strcmp(param, "budget") == 0) {
+		sprintf(context->result, "%d", context->budget);
+	} else if (strcmp(param, "dropped") == 0) {
+		sprintf(context->result, "%d", ATOM_LOAD(&context->dropped));
+	} else if (strcmp(param, "logdropped") == 0) {
+		sprintf(context->result, "%zu", skynet_logwriter_dropped());
+	} else if (strncmp(param, "readbuffer_", 11) == 0) {
+		struct skynet_readbuffer_stat stat;
+		skynet_readbuffer_stat(&stat);
+		const char * what = param + 11;
+		if (strcmp(what, "alloc") == 0) {
+			sprintf(context->result, "%" PRIu64, stat.alloc);
+		} else if (strcmp(what, "hit") == 0) {
+			sprintf(context->result, "%" PRIu64, stat.hit);
+		} else if (strcmp(what, "held") == 0) {
+			sprintf(context->result, "%zu", stat.held);
+		} else {
+			context->result[0] = '\0';
+		}
+	} else if (strncmp(param, "wait_", 5) == 0) {
+		stat_latency(context, context->wait_hist, param + 5);
+	} else if (strncmp(param, "dispatch_", 9) == 0) {
+		stat_latency(context, context->dispatch_hist, param + 9);
 	} else {
 		context->result[0] = '\0';
 	}
 	return context->result;
 }
 
+// LOGON address [text|binary]
 static const char *
 cmd_logon(struct skynet_context * context, const char * param) {
-	uint32_t handle = tohandle(context, param);
+	const char * mode = strchr(param, ' ');
+	size_t sz = mode ? (size_t)(mode - param) : strlen(param);
+	char address[sz+1];
+	memcpy(address, param, sz);
+	address[sz] = '\0';
+	if (mode) {
+		++mode;
+	}
+	uint32_t handle = tohandle(context, address);
 	if (handle == 0)
 		return NULL;
 	struct skynet_context * ctx = skynet_handle_grab(handle);
 	if (ctx == NULL)
 		return NULL;
-	FILE *f = NULL;
-	FILE * lastf = (FILE *)ATOM_LOAD(&ctx->logfile);
-	if (lastf == NULL) {
-		f = skynet_log_open(context, handle);
-		if (f) {
-			if (!ATOM_CAS_POINTER(&ctx->logfile, 0, (uintptr_t)f)) {
+	// cancel the LOGOFF not handled yet
+	ATOM_STORE(&ctx->logoff, 0);
+	struct skynet_log * lastlog = (struct skynet_log *)ATOM_LOAD(&ctx->logfile);
+	if (lastlog == NULL) {
+		struct skynet_log * log = skynet_log_open(context, handle, mode);
+		if (log) {
+			if (!ATOM_CAS_POINTER(&ctx->logfile, 0, (uintptr_t)log)) {
 				// logfile opens in other thread, close this one.
-				fclose(f);
+				skynet_log_close(NULL, log, handle);
 			}
 		}
 	}
@@ -623,12 +923,11 @@ cmd_logoff(struct skynet_context * context, const char * param) {
 	struct skynet_context * ctx = skynet_handle_grab(handle);
 	if (ctx == NULL)
 		return NULL;
-	FILE * f = (FILE *)ATOM_LOAD(&ctx->logfile);
-	if (f) {
-		// logfile may close in other thread
-		if (ATOM_CAS_POINTER(&ctx->logfile, (uintptr_t)f, (uintptr_t)NULL)) {
-			skynet_log_close(context, f, handle);
-		}
+	if (ctx == context) {
+		close_log(ctx);
+	} else if (ATOM_LOAD(&ctx->logfile)) {
+		// the worker of ctx may be writing the log, it closes the log itself
+		ATOM_STORE(&ctx->logoff, 1);
 	}
 	skynet_context_release(ctx);
 	return NULL;
@@ -639,23 +938,86 @@ cmd_signal(struct skynet_context * context, const char * param) {
 	uint32_t handle = tohandle(context, param);
 	if (handle == 0)
 		return NULL;
-	struct skynet_context * ctx = skynet_handle_grab(handle);
-	if (ctx == NULL)
-		return NULL;
 	param = strchr(param, ' ');
 	int sig = 0;
 	if (param) {
 		sig = strtol(param, NULL, 0);
 	}
-	// NOTICE: the signal function should be thread safe.
-	skynet_module_instance_signal(ctx->mod, ctx->instance, sig);
+	skynet_context_signal(handle, sig);
+	return NULL;
+}
 
+static const char * priority_name[MQ_PRIORITY_COUNT] = { "high", "normal", "low" };
+
+// PRIORITY [address] [high|normal|low] , returns the priority class of the service
+static const char *
+cmd_priority(struct skynet_context * context, const char * param) {
+	int size = strlen(param);
+	char addr[size+1];
+	char class[size+1];
+	addr[0] = '\0';
+	class[0] = '\0';
+	if (param[0] == ':' || param[0] == '.') {
+		sscanf(param, "%s %s", addr, class);
+	} else {
+		sscanf(param, "%s", class);
+	}
+	struct skynet_context * ctx = context;
+	if (addr[0]) {
+		uint32_t handle = tohandle(context, addr);
+		if (handle == 0)
+			return NULL;
+		ctx = skynet_handle_grab(handle);
+		if (ctx == NULL)
+			return NULL;
+	} else {
+		skynet_context_grab(ctx);
+	}
+	if (class[0]) {
+		int i;
+		for (i=0;i<MQ_PRIORITY_COUNT;i++) {
+			if (strcmp(class, priority_name[i]) == 0) {
+				skynet_mq_priority(ctx->queue, i);
+				break;
+			}
+		}
+		if (i == MQ_PRIORITY_COUNT) {
+			skynet_error(context, "error: Invalid priority class %s", class);
+		}
+	}
+	strcpy(context->result, priority_name[skynet_mq_getpriority(ctx->queue)]);
 	skynet_context_release(ctx);
-	return NULL;
+	return context->result;
+}
+
+// CAPACITY [n] [reject|drop] : set the mailbox capacity of the service itself, 0 means unlimited.
+// When the mailbox is full, the sending fails (reject), or the message without session is dropped silently (drop).
+// Returns the current capacity.
+static const char *
+cmd_capacity(struct skynet_context * context, const char * param) {
+	if (param && param[0]) {
+		int size = strlen(param);
+		char policy[size+1];
+		int capacity = 0;
+		policy[0] = '\0';
+		if (sscanf(param, "%d %s", &capacity, policy) >= 1) {
+			skynet_mq_capacity(context->queue, capacity > 0 ? capacity : 0);
+		}
+		if (strcmp(policy, "drop") == 0) {
+			context->full_drop = true;
+		} else if (strcmp(policy, "reject") == 0) {
+			context->full_drop = false;
+		} else if (policy[0]) {
+			skynet_error(context, "error: Invalid mailbox policy %s", policy);
+		}
+	}
+	sprintf(context->result, "%d", skynet_mq_getcapacity(context->queue));
+	return context->result;
 }
 
 static struct command_func cmd_funcs[] = {
 	{ "TIMEOUT", cmd_timeout },
+	{ "CANCELTIMEOUT", cmd_canceltimeout },
 	{ "REG", cmd_reg },
 	{ "QUERY", cmd_query },
 	{ "NAME", cmd_name },
@@ -671,6 +1033,8 @@ static struct command_func cmd_funcs[] = {
 	{ "LOGON", cmd_logon },
 	{ "LOGOFF", cmd_logoff },
 	{ "SIGNAL", cmd_signal },
+	{ "PRIORITY", cmd_priority },
+	{ "CAPACITY", cmd_capacity },
 	{ NULL, NULL },
 };
 
@@ -717,6 +1081,13 @@ skynet_send(struct skynet_context * context, uint32_t source, uint32_t destinati
 		}
 		return -2;
 	}
+	// small message to local service, copy it into the destination queue directly if possible
+	bool inline_msg = data && sz <= MESSAGE_INLINE_SIZE
+		&& destination != 0 && !skynet_harbor_message_isremote(destination);
+	bool owned = (type & PTYPE_TAG_DONTCOPY) != 0;
+	if (inline_msg) {
+		type |= PTYPE_TAG_DONTCOPY;
+	}
 	_filter_args(context, type, &session, (void **)&data, &sz);
 
 	if (source == 0) {
@@ -746,14 +1117,99 @@ skynet_send(struct skynet_context * context, uint32_t source, uint32_t destinati
 		smsg.data = data;
 		smsg.sz = sz;
 
-		if (skynet_context_push(destination, &smsg)) {
-			skynet_free(data);
-			return -1;
+		int r = context_send(destination, &smsg, inline_msg, owned);
+		if (r < 0) {
+			return r;
 		}
 	}
 	return session;
 }
 
+#define SEND_BATCH 64
+
+int
+skynet_send_batch(struct skynet_context * context, uint32_t source, int type, struct skynet_batch * batch, int n) {
+	if (source == 0) {
+		source = context->handle;
+	}
+	int sent = 0;
+	int i = 0;
+	while (i < n) {
+		uint32_t destination = batch[i].destination;
+		int j = i + 1;
+		while (j < n && batch[j].destination == destination) {
+			++j;
+		}
+		if (destination == 0 || skynet_harbor_message_isremote(destination)) {
+			for (;i<j;i++) {
+				struct skynet_batch *b = &batch[i];
+				int session = skynet_send(context, source, destination, type, b->session, b->msg, b->sz);
+				if (session >= 0) {
+					b->session = session;
+					++sent;
+				}
+			}
+			continue;
+		}
+		struct skynet_context * ctx = skynet_handle_grab(destination);
+		struct skynet_message smsg[SEND_BATCH];
+		int m = 0;
+		for (;i<j;i++) {
+			struct skynet_batch *b = &batch[i];
+			if ((b->sz & MESSAGE_TYPE_MASK) != b->sz) {
+				skynet_error(context, "error: The message to %x is too large", destination);
+				if (type & PTYPE_TAG_DONTCOPY) {
+					skynet_free(b->msg);
+				}
+				continue;
+			}
+			if (ctx == NULL) {
+				if (type & PTYPE_TAG_DONTCOPY) {
+					skynet_free(b->msg);
+				}
+				continue;
+			}
+			size_t sz = b->sz;
+			void * data = b->msg;
+			if (ctx->inline_msg && !(type & PTYPE_TAG_DONTCOPY) && data && sz <= MESSAGE_INLINE_SIZE) {
+				// the payload is copied when pushing, b->msg is still valid until then
+				_filter_args(context, type | PTYPE_TAG_DONTCOPY, &b->session, &data, &sz);
+				sz |= MESSAGE_TAG_INLINE;
+			} else {
+				_filter_args(context, type, &b->session, &data, &sz);
+			}
+			smsg[m].source = source;
+			smsg[m].session = b->session;
+			smsg[m].data = data;
+			smsg[m].sz = sz;
+			// the messages not pushed yet are not counted, so the capacity is approximate
+			int full = mailbox_check(ctx, &smsg[m]);
+			if (full) {
+				if (!(sz & MESSAGE_TAG_INLINE)) {
+					skynet_free(data);
+				}
+				if (full > 0) {
+					++sent;
+				}
+				continue;
+			}
+			if (++m == SEND_BATCH) {
+				skynet_mq_pushv(ctx->queue, smsg, m);
+				sent += m;
+				m = 0;
+			}
+		}
+		if (ctx) {
+			if (m > 0) {
+				skynet_mq_pushv(ctx->queue, smsg, m);
+				sent += m;
+			}
+			skynet_context_release(ctx);
+		}
+	}
+	return sent;
+}
+
 int
 skynet_sendname(struct skynet_context * context, uint32_t source, const char * addr , int type, int session, void * data, size_t sz) {
 	if (source == 0) {
@@ -805,6 +1261,11 @@ skynet_callback(struct skynet_context * context, void *ud, skynet_cb cb) {
 	context->cb_ud = ud;
 }
 
+void
+skynet_callback_inline(struct skynet_context * context, int enable) {
+	context->inline_msg = (bool)enable;
+}
+
 void
 skynet_context_send(struct skynet_context * ctx, void * msg, size_t sz, uint32_t source, int type, int session) {
 	struct skynet_message smsg;
@@ -820,6 +1281,8 @@ void
 skynet_globalinit(void) {
 	ATOM_INIT(&G_NODE.total , 0);
 	G_NODE.monitor_exit = 0;
+	G_NODE.latency = false;
+	G_NODE.timeslice = DISPATCH_TIMESLICE;
 	G_NODE.init = 1;
 	if (pthread_key_create(&G_NODE.handle_key, NULL)) {
 		fprintf(stderr, "pthread_key_create failed");
@@ -844,3 +1307,14 @@ void
 skynet_profile_enable(int enable) {
 	G_NODE.profile = (bool)enable;
 }
+
+void
+skynet_latency_enable(int enable) {
+	G_NODE.latency = (bool)enable;
+	skynet_mq_stamp_enable(enable);
+}
+
+void
+skynet_timeslice(int microsec) {
+	G_NODE.timeslice = microsec > 0 ? microsec : DISPATCH_TIMESLICE;
+}
@@ -14,19 +14,28 @@ void skynet_context_reserve(struct skynet_context *ctx);
 struct skynet_context * skynet_context_release(struct skynet_context *);
 uint32_t skynet_context_handle(struct skynet_context *);
 int skynet_context_push(uint32_t handle, struct skynet_message *message);
+int skynet_context_pushv(uint32_t handle, struct skynet_message *message, int n);
 void skynet_context_send(struct skynet_context * context, void * msg, size_t sz, uint32_t source, int type, int session);
 int skynet_context_newsession(struct skynet_context *);
-struct message_queue * skynet_context_message_dispatch(struct skynet_monitor *, struct message_queue *, int weight);	// return next queue
+struct message_queue * skynet_context_message_dispatch(struct skynet_monitor *, struct message_queue *);	// return next queue
 int skynet_context_total();
 void skynet_context_dispatchall(struct skynet_context * context);	// for skynet_error output before exit
 
 void skynet_context_endless(uint32_t handle);	// for monitor
+void skynet_context_signal(uint32_t handle, int signal);
+
+// for socket thread, returns 1 if the mailbox is full after pushing, -1 if handle is invalid
+int skynet_context_push_bounded(uint32_t handle, struct skynet_message *message);
+// the socket thread paused some sockets of handle, they are resumed when the mailbox drains
+void skynet_context_socket_paused(uint32_t handle);
 
 void skynet_globalinit(void);
 void skynet_globalexit(void);
 void skynet_initthread(int m);
 
 void skynet_profile_enable(int enable);
+void skynet_latency_enable(int enable);	// record queue wait and dispatch time histograms of each service
+void skynet_timeslice(int microsec);	// the max cpu time a service can take in one dispatch turn
 
 void print_skynet_context(struct skynet_context *ctx);
 #endif
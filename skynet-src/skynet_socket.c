@@ -2,39 +2,181 @@
 
 #include "skynet_socket.h"
 #include "socket_server.h"
+#include "skynet_readbuffer.h"
 #include "skynet_server.h"
 #include "skynet_mq.h"
 #include "skynet_harbor.h"
+#include "spinlock.h"
+#include "atomic.h"
 
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdio.h>
 
-static struct socket_server * SOCKET_SERVER = NULL;
+#define MAX_SOCKET_THREAD 64
 
-void 
-skynet_socket_init() {
-	SOCKET_SERVER = socket_server_create(skynet_now());
+// Each socket thread polls one shard, the id of a socket is n * SOCKET_SHARD + shard
+static struct socket_server * SOCKET_SERVER[MAX_SOCKET_THREAD];
+static int SOCKET_SHARD = 0;
+static ATOM_INT SOCKET_NEXT;
+
+// The sockets paused by the socket thread because the mailbox of the owner is full
+struct paused_socket {
+	uint32_t handle;
+	int id;
+};
+
+struct paused_list {
+	struct spinlock lock;
+	int n;
+	int cap;
+	struct paused_socket *s;
+};
+
+static struct paused_list PAUSED;
+
+static inline struct socket_server *
+shard(int id) {
+	return SOCKET_SERVER[(unsigned)id % SOCKET_SHARD];
+}
+
+// the shard for a new socket
+static inline struct socket_server *
+next_shard() {
+	return SOCKET_SERVER[(unsigned)ATOM_FINC(&SOCKET_NEXT) % SOCKET_SHARD];
+}
+
+int
+skynet_socket_init(int thread, int uring) {
+	if (thread < 1) {
+		thread = 1;
+	} else if (thread > MAX_SOCKET_THREAD) {
+		thread = MAX_SOCKET_THREAD;
+	}
+	int i;
+	for (i=0;i<thread;i++) {
+		SOCKET_SERVER[i] = socket_server_create(skynet_now(), SOCKET_SERVER, i, thread);
+		if (SOCKET_SERVER[i] == NULL) {
+			// socket_server_create reports the error
+			exit(1);
+		}
+		if (uring && socket_server_uring(SOCKET_SERVER[i])) {
+			// the logger is not ready
+			fprintf(stderr, "socket-server: io_uring is not available, use epoll\n");
+			uring = 0;
+		}
+	}
+	SOCKET_SHARD = thread;
+	ATOM_INIT(&SOCKET_NEXT, 0);
+	SPIN_INIT(&PAUSED)
+	PAUSED.n = 0;
+	PAUSED.cap = 0;
+	PAUSED.s = NULL;
+	return thread;
 }
 
 void
 skynet_socket_exit() {
-	socket_server_exit(SOCKET_SERVER);
+	int i;
+	for (i=0;i<SOCKET_SHARD;i++) {
+		socket_server_exit(SOCKET_SERVER[i]);
+	}
 }
 
 void
 skynet_socket_free() {
-	socket_server_release(SOCKET_SERVER);
-	SOCKET_SERVER = NULL;
+	int i;
+	for (i=0;i<SOCKET_SHARD;i++) {
+		socket_server_release(SOCKET_SERVER[i]);
+		SOCKET_SERVER[i] = NULL;
+	}
+	SOCKET_SHARD = 0;
+	skynet_free(PAUSED.s);
+	PAUSED.s = NULL;
+	SPIN_DESTROY(&PAUSED)
 }
 
 void
 skynet_socket_updatetime() {
-	socket_server_updatetime(SOCKET_SERVER, skynet_now());
+	uint64_t now = skynet_now();
+	int i;
+	for (i=0;i<SOCKET_SHARD;i++) {
+		socket_server_updatetime(SOCKET_SERVER[i], now);
+	}
+}
+
+// socket threads
+static void
+pause_socket(uint32_t handle, int id) {
+	int i;
+	SPIN_LOCK(&PAUSED)
+	for (i=0;i<PAUSED.n;i++) {
+		if (PAUSED.s[i].id == id) {
+			// data arrives before the pause request is handled
+			SPIN_UNLOCK(&PAUSED)
+			return;
+		}
+	}
+	if (PAUSED.n >= PAUSED.cap) {
+		int cap = PAUSED.cap ? PAUSED.cap * 2 : 16;
+		struct paused_socket *s = skynet_malloc(cap * sizeof(*s));
+		if (PAUSED.n > 0) {
+			memcpy(s, PAUSED.s, PAUSED.n * sizeof(*s));
+		}
+		skynet_free(PAUSED.s);
+		PAUSED.s = s;
+		PAUSED.cap = cap;
+	}
+	PAUSED.s[PAUSED.n].handle = handle;
+	PAUSED.s[PAUSED.n].id = id;
+	++PAUSED.n;
+	SPIN_UNLOCK(&PAUSED)
+
+	// called in the socket thread of the shard, don't wait for its own ctrl queue
+	socket_server_pause_local(shard(id), id);
+	// set the flag after the socket is in the list, the owner resumes it when its mailbox drains
+	skynet_context_socket_paused(handle);
+}
+
+// socket threads, the socket is closed, its id may be reused
+static void
+unpause_socket(int id) {
+	int i;
+	SPIN_LOCK(&PAUSED)
+	for (i=0;i<PAUSED.n;i++) {
+		if (PAUSED.s[i].id == id) {
+			PAUSED.s[i] = PAUSED.s[--PAUSED.n];
+			break;
+		}
+	}
+	SPIN_UNLOCK(&PAUSED)
+}
+
+void
+skynet_socket_resume(uint32_t handle) {
+	int ids[16];
+	int n;
+	do {
+		n = 0;
+		int i = 0;
+		SPIN_LOCK(&PAUSED)
+		while (i < PAUSED.n && n < 16) {
+			if (PAUSED.s[i].handle == handle) {
+				ids[n++] = PAUSED.s[i].id;
+				PAUSED.s[i] = PAUSED.s[--PAUSED.n];
+			} else {
+				++i;
+			}
+		}
+		SPIN_UNLOCK(&PAUSED)
+		for (i=0;i<n;i++) {
+			socket_server_continue(shard(ids[i]), handle, ids[i]);
+		}
+	} while (n == 16);
 }
 
-// mainloop thread
 static void
 forward_message(int type, bool padding, struct socket_message * result) {
 	struct skynet_socket_message *sm;
@@ -67,17 +209,21 @@ forward_message(int type, bool padding, struct socket_message * result) {
 	message.data = sm;
 	message.sz = sz | ((size_t)PTYPE_SOCKET << MESSAGE_TYPE_SHIFT);
 	
-	if (skynet_context_push((uint32_t)result->opaque, &message)) {
+	int r = skynet_context_push_bounded((uint32_t)result->opaque, &message);
+	if (r < 0) {
 		// todo: report somewhere to close socket
 		// don't call skynet_socket_close here (It will block mainloop)
-		skynet_free(sm->buffer);
+		skynet_readbuffer_free(sm->buffer);
 		skynet_free(sm);
+	} else if (r > 0 && (type == SKYNET_SOCKET_TYPE_DATA || type == SKYNET_SOCKET_TYPE_UDP)) {
+		// the mailbox is full, stop reading until it drains
+		pause_socket((uint32_t)result->opaque, result->id);
 	}
 }
 
 int 
-skynet_socket_poll() {
-	struct socket_server *ss = SOCKET_SERVER;
+skynet_socket_poll(int thread) {
+	struct socket_server *ss = SOCKET_SERVER[thread];
 	assert(ss);
 	struct socket_message result;
 	int more = 1;
@@ -89,12 +235,14 @@ skynet_socket_poll() {
 		forward_message(SKYNET_SOCKET_TYPE_DATA, false, &result);
 		break;
 	case SOCKET_CLOSE:
+		unpause_socket(result.id);
 		forward_message(SKYNET_SOCKET_TYPE_CLOSE, false, &result);
 		break;
 	case SOCKET_OPEN:
 		forward_message(SKYNET_SOCKET_TYPE_CONNECT, true, &result);
 		break;
 	case SOCKET_ERR:
+		unpause_socket(result.id);
 		forward_message(SKYNET_SOCKET_TYPE_ERROR, true, &result);
 		break;
 	case SOCKET_ACCEPT:
@@ -118,88 +266,88 @@ skynet_socket_poll() {
 
 int
 skynet_socket_sendbuffer(struct skynet_context *ctx, struct socket_sendbuffer *buffer) {
-	return socket_server_send(SOCKET_SERVER, buffer);
+	return socket_server_send(shard(buffer->id), buffer);
 }
 
 int
 skynet_socket_sendbuffer_lowpriority(struct skynet_context *ctx, struct socket_sendbuffer *buffer) {
-	return socket_server_send_lowpriority(SOCKET_SERVER, buffer);
+	return socket_server_send_lowpriority(shard(buffer->id), buffer);
 }
 
 int 
 skynet_socket_listen(struct skynet_context *ctx, const char *host, int port, int backlog) {
 	uint32_t source = skynet_context_handle(ctx);
-	return socket_server_listen(SOCKET_SERVER, source, host, port, backlog);
+	return socket_server_listen(next_shard(), source, host, port, backlog);
 }
 
 int 
 skynet_socket_connect(struct skynet_context *ctx, const char *host, int port) {
 	uint32_t source = skynet_context_handle(ctx);
-	return socket_server_connect(SOCKET_SERVER, source, host, port);
+	return socket_server_connect(next_shard(), source, host, port);
 }
 
 int 
 skynet_socket_bind(struct skynet_context *ctx, int fd) {
 	uint32_t source = skynet_context_handle(ctx);
-	return socket_server_bind(SOCKET_SERVER, source, fd);
+	return socket_server_bind(next_shard(), source, fd);
 }
 
 void 
 skynet_socket_close(struct skynet_context *ctx, int id) {
 	uint32_t source = skynet_context_handle(ctx);
-	socket_server_close(SOCKET_SERVER, source, id);
+	socket_server_close(shard(id), source, id);
 }
 
 void 
 skynet_socket_shutdown(struct skynet_context *ctx, int id) {
 	uint32_t source = skynet_context_handle(ctx);
-	socket_server_shutdown(SOCKET_SERVER, source, id);
+	socket_server_shutdown(shard(id), source, id);
 }
 
 void 
 skynet_socket_start(struct skynet_context *ctx, int id) {
 	uint32_t source = skynet_context_handle(ctx);
-	socket_server_start(SOCKET_SERVER, source, id);
+	socket_server_start(shard(id), source, id);
 }
 
 void
 skynet_socket_pause(struct skynet_context *ctx, int id) {
 	uint32_t source = skynet_context_handle(ctx);
-	socket_server_pause(SOCKET_SERVER, source, id);
+	socket_server_pause(shard(id), source, id);
 }
 
 
 void
 skynet_socket_nodelay(struct skynet_context *ctx, int id) {
-	socket_server_nodelay(SOCKET_SERVER, id);
+	socket_server_nodelay(shard(id), id);
 }
 
 int 
 skynet_socket_udp(struct skynet_context *ctx, const char * addr, int port) {
 	uint32_t source = skynet_context_handle(ctx);
-	return socket_server_udp(SOCKET_SERVER, source, addr, port);
+	return socket_server_udp(next_shard(), source, addr, port);
 }
 
 int
 skynet_socket_udp_dial(struct skynet_context *ctx, const char * addr, int port){
 	uint32_t source = skynet_context_handle(ctx);
-	return socket_server_udp_dial(SOCKET_SERVER, source, addr, port);
+	return socket_server_udp_dial(next_shard(), source, addr, port);
 }
 
 int
 skynet_socket_udp_listen(struct skynet_context *ctx, const char * addr, int port){
 	uint32_t source = skynet_context_handle(ctx);
-	return socket_server_udp_listen(SOCKET_SERVER, source, addr, port);
+	return socket_server_udp_listen(next_shard(), source, addr, port);
 }
 
 int 
 skynet_socket_udp_connect(struct skynet_context *ctx, int id, const char * addr, int port) {
-	return socket_server_udp_connect(SOCKET_SERVER, id, addr, port);
+	return socket_server_udp_connect(shard(id), id, addr, port);
 }
 
 int 
 skynet_socket_udp_sendbuffer(struct skynet_context *ctx, const char * address, struct socket_sendbuffer *buffer) {
-	return socket_server_udp_send(SOCKET_SERVER, (const struct socket_udp_address *)address, buffer);
+	return socket_server_udp_send(shard(buffer->id), (const struct socket_udp_address *)address, buffer);
 }
 
 const char *
@@ -212,10 +360,23 @@ skynet_socket_udp_address(struct skynet_socket_message *msg, int *addrsz) {
 	sm.opaque = 0;
 	sm.ud = msg->ud;
 	sm.data = msg->buffer;
-	return (const char *)socket_server_udp_address(SOCKET_SERVER, &sm, addrsz);
+	return (const char *)socket_server_udp_address(shard(sm.id), &sm, addrsz);
 }
 
 struct socket_info *
 skynet_socket_info() {
-	return socket_server_info(SOCKET_SERVER);
+	struct socket_info *si = NULL;
+	int i;
+	for (i=SOCKET_SHARD-1;i>=0;i--) {
+		struct socket_info *list = socket_server_info(SOCKET_SERVER[i]);
+		if (list) {
+			struct socket_info *last = list;
+			while (last->next) {
+				last = last->next;
+			}
+			last->next = si;
+			si = list;
+		}
+	}
+	return si;
 }
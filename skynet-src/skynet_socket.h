@@ -4,6 +4,8 @@
 #include "socket_info.h"
 #include "socket_buffer.h"
 
+#include <stdint.h>
+
 struct skynet_context;
 
 #define SKYNET_SOCKET_TYPE_DATA 1
@@ -18,14 +20,17 @@ struct skynet_socket_message {
 	int type;
 	int id;
 	int ud;
-	char * buffer;
+	char * buffer;	// DATA and UDP only, release it by skynet_readbuffer_free
 };
 
-void skynet_socket_init();
+// returns the number of socket threads
+int skynet_socket_init(int thread, int uring);
 void skynet_socket_exit();
 void skynet_socket_free();
-int skynet_socket_poll();
+int skynet_socket_poll(int thread);
 void skynet_socket_updatetime();
+// resume the sockets paused because the mailbox of handle was full
+void skynet_socket_resume(uint32_t handle);
 
 int skynet_socket_sendbuffer(struct skynet_context *ctx, struct socket_sendbuffer *buffer);
 int skynet_socket_sendbuffer_lowpriority(struct skynet_context *ctx, struct socket_sendbuffer *buffer);
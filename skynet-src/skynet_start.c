@@ -9,6 +9,12 @@
 #include "skynet_socket.h"
 #include "skynet_daemon.h"
 #include "skynet_harbor.h"
+#include "skynet_affinity.h"
+#include "skynet_logwriter.h"
+#include "skynet_readbuffer.h"
+#include "spinlock.h"
+#include "atomic.h"
+#include "park.h"
 
 #include <pthread.h>
 #include <unistd.h>
@@ -18,19 +24,35 @@
 #include <string.h>
 #include <signal.h>
 
+#define WORKER_RUNNING 0
+#define WORKER_PARKED 1
+
+// pause times between two tries in a spin round
+#define SPIN_PAUSE 32
+// the timer thread wakes up at least once in it (microsec) for abort and SIGHUP, when timer_event is on
+#define TIMER_MAX_SLEEP 100000
+// endless loop check period of the monitor thread (microsec)
+#define MONITOR_PERIOD 5000000
+
+struct worker_park {
+	struct park p;
+	int spin;	// spin rounds before park, adjusted between spin_min and spin_max
+};
+
 struct monitor {
 	int count;
 	struct skynet_monitor ** m;
-	pthread_cond_t cond;
-	pthread_mutex_t mutex;
-	int sleep;
-	int quit;
+	struct worker_park * park;
+	int spin_max;
+	struct skynet_config * config;
+	ATOM_INT sleep;
+	ATOM_INT next;	// the worker to try first in wakeup
+	ATOM_INT quit;
 };
 
 struct worker_parm {
 	struct monitor *m;
 	int id;
-	int weight;
 };
 
 static volatile int SIG = 0;
@@ -52,20 +74,44 @@ create_thread(pthread_t *thread, void *(*start_routine) (void *), void *arg) {
 	}
 }
 
+// Change a parked worker to running, return 1 if the caller should wake it
+static int
+unpark(struct monitor *m, struct worker_park *w) {
+	while (ATOM_LOAD(&w->p.state) == WORKER_PARKED) {
+		if (ATOM_CAS(&w->p.state, WORKER_PARKED, WORKER_RUNNING)) {
+			ATOM_FDEC(&m->sleep);
+			return 1;
+		}
+	}
+	return 0;
+}
+
 static void
 wakeup(struct monitor *m, int busy) {
-	if (m->sleep >= m->count - busy) {
-		// signal sleep worker, "spurious wakeup" is harmless
-		pthread_cond_signal(&m->cond);
+	if (ATOM_LOAD(&m->sleep) >= m->count - busy) {
+		// wake only one parked worker
+		int n = m->count;
+		int start = (unsigned)ATOM_FINC(&m->next) % n;
+		int i;
+		for (i=0;i<n;i++) {
+			struct worker_park *w = &m->park[(start + i) % n];
+			if (unpark(m, w)) {
+				park_wake(&w->p);
+				return;
+			}
+		}
 	}
 }
 
 static void *
 thread_socket(void *p) {
-	struct monitor * m = p;
+	struct worker_parm *wp = p;
+	struct monitor * m = wp->m;
 	skynet_initthread(THREAD_SOCKET);
+	// one socket thread uses all the cpus of the list, or each binds to one of them
+	skynet_affinity_bind(m->config->affinity_socket, m->config->socket_thread > 1 ? wp->id : -1);
 	for (;;) {
-		int r = skynet_socket_poll();
+		int r = skynet_socket_poll(wp->id);
 		if (r==0)
 			break;
 		if (r<0) {
@@ -83,28 +129,41 @@ free_monitor(struct monitor *m) {
 	int n = m->count;
 	for (i=0;i<n;i++) {
 		skynet_monitor_delete(m->m[i]);
+		park_destroy(&m->park[i].p);
 	}
-	pthread_mutex_destroy(&m->mutex);
-	pthread_cond_destroy(&m->cond);
 	skynet_free(m->m);
+	skynet_free(m->park);
 	skynet_free(m);
 }
 
 // 每隔 5 秒检查一下所有 monitor，侦测死锁
+// slow messages are checked every skynet_monitor_slow_interval() between them
 static void *
 thread_monitor(void *p) {
 	struct monitor * m = p;
-	int i;
+	int i,t;
 	int n = m->count;
+	int slow = skynet_monitor_slow_interval();
 	skynet_initthread(THREAD_MONITOR);
+	skynet_affinity_bind(m->config->affinity_monitor, -1);
 	for (;;) {
 		CHECK_ABORT
 		for (i=0;i<n;i++) {
 			skynet_monitor_check(m->m[i]);
 		}
-		for (i=0;i<5;i++) {
+		if (slow == 0) {
+			for (i=0;i<5;i++) {
+				CHECK_ABORT
+				sleep(1);
+			}
+			continue;
+		}
+		for (t=0;t<MONITOR_PERIOD;t+=slow) {
 			CHECK_ABORT
-			sleep(1);
+			usleep(slow);
+			for (i=0;i<n;i++) {
+				skynet_monitor_check_slow(m->m[i]);
+			}
 		}
 	}
 
@@ -114,6 +173,7 @@ thread_monitor(void *p) {
 static void
 signal_hup() {
 	// make log file reopen
+	skynet_logwriter_reopen();
 
 	struct skynet_message smsg;
 	smsg.source = 0;
@@ -130,12 +190,17 @@ static void *
 thread_timer(void *p) {
 	struct monitor * m = p;
 	skynet_initthread(THREAD_TIMER);
+	skynet_affinity_bind(m->config->affinity_timer, -1);
 	for (;;) {
 		skynet_updatetime();
 		skynet_socket_updatetime();
 		CHECK_ABORT
 		wakeup(m,m->count-1);
-		usleep(2500);
+		if (m->config->timer_event) {
+			skynet_timer_wait(TIMER_MAX_SLEEP);
+		} else {
+			usleep(m->config->timer_precision == 1 ? 500 : 2500);
+		}
 		if (SIG) {
 			signal_hup();
 			SIG = 0;
@@ -144,10 +209,53 @@ thread_timer(void *p) {
 	// wakeup socket thread
 	skynet_socket_exit();
 	// wakeup all worker thread
-	pthread_mutex_lock(&m->mutex);
-	m->quit = 1;
-	pthread_cond_broadcast(&m->cond);
-	pthread_mutex_unlock(&m->mutex);
+	ATOM_STORE(&m->quit, 1);
+	int i;
+	for (i=0;i<m->count;i++) {
+		if (unpark(m, &m->park[i])) {
+			park_wake(&m->park[i].p);
+		}
+	}
+	return NULL;
+}
+
+// Spin a while before park, returns a message queue if some arrived.
+// The spin rounds grow when spinning finds work, and shrink when it doesn't.
+static struct message_queue *
+worker_spin(struct monitor *m, struct worker_park *w) {
+	int i,j;
+	for (i=0;i<w->spin;i++) {
+		for (j=0;j<SPIN_PAUSE;j++) {
+			atomic_pause_();
+		}
+		struct message_queue * q = skynet_globalmq_pop();
+		if (q) {
+			w->spin *= 2;
+			if (w->spin > m->spin_max)
+				w->spin = m->spin_max;
+			return q;
+		}
+	}
+	w->spin /= 2;
+	if (w->spin < m->spin_max / 8 + 1)
+		w->spin = m->spin_max / 8 + 1;
+	if (w->spin > m->spin_max)
+		w->spin = m->spin_max;
+	return NULL;
+}
+
+static struct message_queue *
+worker_park(struct monitor *m, struct worker_park *w) {
+	ATOM_STORE(&w->p.state, WORKER_PARKED);
+	ATOM_FINC(&m->sleep);
+	// check again after the state is published, wakeup() may miss this worker before
+	struct message_queue * q = skynet_globalmq_pop();
+	if (q || ATOM_LOAD(&m->quit)) {
+		// it fails if someone else has woken this worker, it's harmless
+		unpark(m, w);
+		return q;
+	}
+	park_wait(&w->p, WORKER_PARKED);
 	return NULL;
 }
 
@@ -155,25 +263,24 @@ static void *
 thread_worker(void *p) {
 	struct worker_parm *wp = p;
 	int id = wp->id;
-	int weight = wp->weight;
 	struct monitor *m = wp->m;
 	struct skynet_monitor *sm = m->m[id];
+	struct worker_park *w = &m->park[id];
 	skynet_initthread(THREAD_WORKER);
+	// each worker binds to one cpu of the list
+	skynet_affinity_bind(m->config->affinity_worker, id);
+	skynet_globalmq_worker(id);
 	struct message_queue * q = NULL;
-	while (!m->quit) {
-		q = skynet_context_message_dispatch(sm, q, weight);
+	while (!ATOM_LOAD(&m->quit)) {
+		q = skynet_context_message_dispatch(sm, q);
+		if (m->config->timer_event && ATOM_LOAD(&m->sleep) > 0 && skynet_globalmq_surplus()) {
+			// the timer thread doesn't wake up idle workers periodically, do it when there is more work
+			wakeup(m, m->count-1);
+		}
 		if (q == NULL) {
-			if (pthread_mutex_lock(&m->mutex) == 0) {
-				++ m->sleep;
-				// "spurious wakeup" is harmless,
-				// because skynet_context_message_dispatch() can be call at any time.
-				if (!m->quit)
-					pthread_cond_wait(&m->cond, &m->mutex);
-				-- m->sleep;
-				if (pthread_mutex_unlock(&m->mutex)) {
-					fprintf(stderr, "unlock mutex error");
-					exit(1);
-				}
+			q = worker_spin(m, w);
+			if (q == NULL) {
+				q = worker_park(m, w);
 			}
 		}
 	}
@@ -181,50 +288,48 @@ thread_worker(void *p) {
 }
 
 static void
-start(int thread) {
-	pthread_t pid[thread+3];
+start(struct skynet_config * config) {
+	int thread = config->thread;
+	int spin = config->spin;
+	int socket_thread = config->socket_thread;
+	pthread_t pid[thread+socket_thread+2];
 
 	struct monitor *m = skynet_malloc(sizeof(*m));
 	memset(m, 0, sizeof(*m));
 	m->count = thread;
-	m->sleep = 0;
+	m->spin_max = spin > 0 ? spin : 0;
+	m->config = config;
+	ATOM_INIT(&m->sleep, 0);
+	ATOM_INIT(&m->next, 0);
+	ATOM_INIT(&m->quit, 0);
 
 	m->m = skynet_malloc(thread * sizeof(struct skynet_monitor *));
+	m->park = skynet_malloc(thread * sizeof(struct worker_park));
 	int i;
 	for (i=0;i<thread;i++) {
 		m->m[i] = skynet_monitor_new();
-	}
-	if (pthread_mutex_init(&m->mutex, NULL)) {
-		fprintf(stderr, "Init mutex error");
-		exit(1);
-	}
-	if (pthread_cond_init(&m->cond, NULL)) {
-		fprintf(stderr, "Init cond error");
-		exit(1);
+		park_init(&m->park[i].p, WORKER_RUNNING);
+		m->park[i].spin = m->spin_max;
 	}
 
 	create_thread(&pid[0], thread_monitor, m);
 	create_thread(&pid[1], thread_timer, m);
-	create_thread(&pid[2], thread_socket, m);
 
-	static int weight[] = { 
-		-1, -1, -1, -1, 0, 0, 0, 0,
-		1, 1, 1, 1, 1, 1, 1, 1, 
-		2, 2, 2, 2, 2, 2, 2, 2, 
-		3, 3, 3, 3, 3, 3, 3, 3, };
+	struct worker_parm sp[socket_thread];
+	for (i=0;i<socket_thread;i++) {
+		sp[i].m = m;
+		sp[i].id = i;
+		create_thread(&pid[i+2], thread_socket, &sp[i]);
+	}
+
 	struct worker_parm wp[thread];
 	for (i=0;i<thread;i++) {
 		wp[i].m = m;
 		wp[i].id = i;
-		if (i < sizeof(weight)/sizeof(weight[0])) {
-			wp[i].weight= weight[i];
-		} else {
-			wp[i].weight = 0;
-		}
-		create_thread(&pid[i+3], thread_worker, &wp[i]);
+		create_thread(&pid[i+socket_thread+2], thread_worker, &wp[i]);
 	}
 
-	for (i=0;i<thread+3;i++) {
+	for (i=0;i<thread+socket_thread+2;i++) {
 		pthread_join(pid[i], NULL); 
 	}
 
@@ -251,6 +356,7 @@ bootstrap(struct skynet_context * logger, const char * cmdline) {
 	if (ctx == NULL) {
 		skynet_error(NULL, "Bootstrap error : %s\n", cmdline);
 		skynet_context_dispatchall(logger);
+		skynet_logwriter_exit();
 		exit(1);
 	}
 }
@@ -271,13 +377,27 @@ skynet_start(struct skynet_config * config) {
 	}
 	skynet_harbor_init(config->harbor);
 	skynet_handle_init(config->harbor);
-	skynet_mq_init();
+	skynet_mq_init(config->thread);
 	skynet_module_init(config->module_path);
-	skynet_timer_init();
-	skynet_socket_init();
+	skynet_timer_init(config->timer_precision);
+	skynet_readbuffer_init(config->socket_readpool);
+	config->socket_thread = skynet_socket_init(config->socket_thread, config->socket_uring);
 	skynet_profile_enable(config->profile);
+	skynet_latency_enable(config->latency);
+	skynet_timeslice(config->timeslice);
+	skynet_monitor_slow_threshold(config->slow_threshold);
+
+	const char * logger = config->logger;
+	if (config->logasync) {
+		if (skynet_logwriter_init(config->logger, config->logbuffer, config->logflush,
+			(size_t)config->logrotate_size * 1024 * 1024, config->logrotate_time)) {
+			exit(1);
+		}
+		// the log file is written by skynet_logwriter
+		logger = NULL;
+	}
 
-	struct skynet_context *ctx = skynet_context_new(config->logservice, config->logger);
+	struct skynet_context *ctx = skynet_context_new(config->logservice, logger);
 	if (ctx == NULL) {
 		fprintf(stderr, "Can't launch %s service\n", config->logservice);
 		exit(1);
@@ -287,11 +407,13 @@ skynet_start(struct skynet_config * config) {
 
 	bootstrap(ctx, config->bootstrap);
 
-	start(config->thread);
+	start(config);
 
 	// harbor_exit may call socket send, so it should exit before socket_free
 	skynet_harbor_exit();
 	skynet_socket_free();
+	skynet_readbuffer_exit();
+	skynet_logwriter_exit();
 	if (config->daemon) {
 		daemon_exit(config->daemon);
 	}
@@ -5,14 +5,14 @@
 #include "skynet_server.h"
 #include "skynet_handle.h"
 #include "spinlock.h"
+#include "park.h"
 
 #include <time.h>
 #include <assert.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
-
-typedef void (*timer_execute_func)(void *ud,void *arg);
+#include <limits.h>
 
 #define TIME_NEAR_SHIFT 8
 #define TIME_NEAR (1 << TIME_NEAR_SHIFT)
@@ -21,56 +21,182 @@ typedef void (*timer_execute_func)(void *ud,void *arg);
 #define TIME_NEAR_MASK (TIME_NEAR-1)
 #define TIME_LEVEL_MASK (TIME_LEVEL-1)
 
-struct timer_event {
-	uint32_t handle;
-	int session;
-};
+// The timer thread sleeps on timer.sleep until the next expiry, see skynet_timer_wait
+#define TIMER_AWAKE 0
+#define TIMER_SLEEP 1
+
+// timer nodes are allocated in slabs, and never freed
+#define TIMER_SLAB 256
+#define TIMER_HASH_DEFAULT 256
+
+// The timers are sharded by handle, each shard has its own wheel and lock, the timer thread drives all of them.
+#define TIMER_SHARD 16
+// The expired timers of the same service are pushed together, at most TIMER_BATCH messages once
+#define TIMER_BATCH 64
 
 struct timer_node {
 	struct timer_node *next;
+	struct timer_node *prev;
+	struct timer_node *hnext;	// in timer_wheel.hash, for cancellation
 	uint32_t expire;
+	uint32_t handle;
+	int session;
 };
 
+// circular double linked list, so a node can be removed without the list
 struct link_list {
 	struct timer_node head;
-	struct timer_node *tail;
 };
 
-struct timer {
+struct timer_wheel {
 	struct link_list near[TIME_NEAR];
 	struct link_list t[4][TIME_LEVEL];
 	struct spinlock lock;
-	uint32_t time;
+	uint32_t time;	// in tick, the same in all shards
+	struct timer_node *freelist;
+	// the nodes in the wheel, index by (handle, session)
+	struct timer_node **hash;
+	int hash_size;
+	int count;
+};
+
+struct timer {
+	struct timer_wheel shard[TIMER_SHARD];
+	uint32_t time;	// in tick, only the timer thread uses it
 	uint32_t starttime;
-	uint64_t current;
-	uint64_t current_point;
+	uint64_t current;	// in tick
+	uint64_t current_point;	// in tick
+	int tick_cs;	// ticks per centisecond, 1 (10ms wheel) or 10 (1ms wheel)
+	int tick_usec;	// microseconds per tick
+	ATOM_INT wake;	// the timer thread wakes up at this tick, valid when sleep.state is TIMER_SLEEP
+	struct park sleep;
 };
 
 static struct timer * TI = NULL;
 
+static inline struct timer_wheel *
+timer_shard(struct timer *T, uint32_t handle) {
+	return &T->shard[handle % TIMER_SHARD];
+}
+
+static inline void
+link_init(struct link_list *list) {
+	list->head.next = &list->head;
+	list->head.prev = &list->head;
+}
+
+static inline int
+link_empty(struct link_list *list) {
+	return list->head.next == &list->head;
+}
+
+// returns the nodes as a chain ends with NULL
 static inline struct timer_node *
 link_clear(struct link_list *list) {
+	if (link_empty(list)) {
+		return NULL;
+	}
 	struct timer_node * ret = list->head.next;
-	list->head.next = 0;
-	list->tail = &(list->head);
+	list->head.prev->next = NULL;
+	link_init(list);
 
 	return ret;
 }
 
 static inline void
-link(struct link_list *list,struct timer_node *node) {
-	list->tail->next = node;
-	list->tail = node;
-	node->next=0;
+link_node(struct link_list *list,struct timer_node *node) {
+	struct timer_node *tail = list->head.prev;
+	tail->next = node;
+	node->prev = tail;
+	node->next = &list->head;
+	list->head.prev = node;
+}
+
+static inline void
+link_remove(struct timer_node *node) {
+	node->prev->next = node->next;
+	node->next->prev = node->prev;
+}
+
+static inline struct timer_node **
+hash_slot(struct timer_wheel *W, uint32_t handle, int session) {
+	uint32_t h = (handle * 0x9e3779b1u) ^ (uint32_t)session;
+	return &W->hash[h & (W->hash_size - 1)];
 }
 
 static void
-add_node(struct timer *T,struct timer_node *node) {
+hash_insert(struct timer_wheel *W, struct timer_node *node) {
+	if (W->count >= W->hash_size) {
+		// rehash
+		struct timer_node **old = W->hash;
+		int old_size = W->hash_size;
+		W->hash_size *= 2;
+		W->hash = skynet_malloc(W->hash_size * sizeof(struct timer_node *));
+		memset(W->hash, 0, W->hash_size * sizeof(struct timer_node *));
+		int i;
+		for (i=0;i<old_size;i++) {
+			struct timer_node *n = old[i];
+			while (n) {
+				struct timer_node *next = n->hnext;
+				struct timer_node **slot = hash_slot(W, n->handle, n->session);
+				n->hnext = *slot;
+				*slot = n;
+				n = next;
+			}
+		}
+		skynet_free(old);
+	}
+	struct timer_node **slot = hash_slot(W, node->handle, node->session);
+	node->hnext = *slot;
+	*slot = node;
+	++W->count;
+}
+
+static struct timer_node *
+hash_remove(struct timer_wheel *W, uint32_t handle, int session) {
+	struct timer_node **p = hash_slot(W, handle, session);
+	while (*p) {
+		struct timer_node *node = *p;
+		if (node->handle == handle && node->session == session) {
+			*p = node->hnext;
+			--W->count;
+			return node;
+		}
+		p = &node->hnext;
+	}
+	return NULL;
+}
+
+static struct timer_node *
+node_alloc(struct timer_wheel *W) {
+	struct timer_node *node = W->freelist;
+	if (node == NULL) {
+		struct timer_node *slab = skynet_malloc(TIMER_SLAB * sizeof(*slab));
+		int i;
+		for (i=0;i<TIMER_SLAB-1;i++) {
+			slab[i].next = &slab[i+1];
+		}
+		slab[TIMER_SLAB-1].next = NULL;
+		node = slab;
+	}
+	W->freelist = node->next;
+	return node;
+}
+
+// free a chain of nodes
+static void
+node_free(struct timer_wheel *W, struct timer_node *head, struct timer_node *tail) {
+	tail->next = W->freelist;
+	W->freelist = head;
+}
+
+static void
+add_node(struct timer_wheel *W,struct timer_node *node) {
 	uint32_t time=node->expire;
-	uint32_t current_time=T->time;
+	uint32_t current_time=W->time;
 	
 	if ((time|TIME_NEAR_MASK)==(current_time|TIME_NEAR_MASK)) {
-		link(&T->near[time&TIME_NEAR_MASK],node);
+		link_node(&W->near[time&TIME_NEAR_MASK],node);
 	} else {
 		int i;
 		uint32_t mask=TIME_NEAR << TIME_LEVEL_SHIFT;
@@ -81,39 +207,62 @@ add_node(struct timer *T,struct timer_node *node) {
 			mask <<= TIME_LEVEL_SHIFT;
 		}
 
-		link(&T->t[i][((time>>(TIME_NEAR_SHIFT + i*TIME_LEVEL_SHIFT)) & TIME_LEVEL_MASK)],node);	
+		link_node(&W->t[i][((time>>(TIME_NEAR_SHIFT + i*TIME_LEVEL_SHIFT)) & TIME_LEVEL_MASK)],node);	
 	}
 }
 
 static void
-timer_add(struct timer *T,void *arg,size_t sz,int time) {
-	struct timer_node *node = (struct timer_node *)skynet_malloc(sizeof(*node)+sz);
-	memcpy(node+1,arg,sz);
-
-	SPIN_LOCK(T);
-
-		node->expire=time+T->time;
-		add_node(T,node);
+timer_add(struct timer *T, uint32_t handle, int session, int time) {
+	struct timer_wheel *W = timer_shard(T, handle);
+	SPIN_LOCK(W);
+
+		struct timer_node *node = node_alloc(W);
+		node->handle = handle;
+		node->session = session;
+		node->expire=time+W->time;
+		add_node(W,node);
+		hash_insert(W,node);
+		uint32_t expire = node->expire;
+
+	SPIN_UNLOCK(W);
+
+	// the timer thread sleeps longer than this timer
+	if (ATOM_LOAD(&T->sleep.state) == TIMER_SLEEP && (int32_t)(expire - (uint32_t)ATOM_LOAD(&T->wake)) < 0) {
+		if (ATOM_CAS(&T->sleep.state, TIMER_SLEEP, TIMER_AWAKE)) {
+			park_wake(&T->sleep);
+		}
+	}
+}
 
-	SPIN_UNLOCK(T);
+static int
+timer_cancel(struct timer *T, uint32_t handle, int session) {
+	struct timer_wheel *W = timer_shard(T, handle);
+	SPIN_LOCK(W);
+	struct timer_node *node = hash_remove(W, handle, session);
+	if (node) {
+		link_remove(node);
+		node_free(W, node, node);
+	}
+	SPIN_UNLOCK(W);
+	return node != NULL;
 }
 
 static void
-move_list(struct timer *T, int level, int idx) {
-	struct timer_node *current = link_clear(&T->t[level][idx]);
+move_list(struct timer_wheel *W, int level, int idx) {
+	struct timer_node *current = link_clear(&W->t[level][idx]);
 	while (current) {
 		struct timer_node *temp=current->next;
-		add_node(T,current);
+		add_node(W,current);
 		current=temp;
 	}
 }
 
 static void
-timer_shift(struct timer *T) {
+timer_shift(struct timer_wheel *W) {
 	int mask = TIME_NEAR;
-	uint32_t ct = ++T->time;
+	uint32_t ct = ++W->time;
 	if (ct == 0) {
-		move_list(T, 3, 0);
+		move_list(W, 3, 0);
 	} else {
 		uint32_t time = ct >> TIME_NEAR_SHIFT;
 		int i=0;
@@ -121,7 +270,7 @@ timer_shift(struct timer *T) {
 		while ((ct & (mask-1))==0) {
 			int idx=time & TIME_LEVEL_MASK;
 			if (idx!=0) {
-				move_list(T, i, idx);
+				move_list(W, i, idx);
 				break;				
 			}
 			mask <<= TIME_LEVEL_SHIFT;
@@ -131,78 +280,146 @@ timer_shift(struct timer *T) {
 	}
 }
 
-static inline void
+struct expired {
+	uint32_t handle;
+	int index;	// keep the order of the same handle
+	int session;
+};
+
+static int
+compar_expired(const void *a, const void *b) {
+	const struct expired *ea = a;
+	const struct expired *eb = b;
+	if (ea->handle != eb->handle)
+		return ea->handle < eb->handle ? -1 : 1;
+	return ea->index - eb->index;
+}
+
+// push n expired timers, the ones of the same service are pushed together
+static void
+dispatch_expired(struct expired *e, int n) {
+	if (n > 1) {
+		qsort(e, n, sizeof(*e), compar_expired);
+	}
+	struct skynet_message message[TIMER_BATCH];
+	int i = 0;
+	while (i < n) {
+		uint32_t handle = e[i].handle;
+		int m = 0;
+		for (;i<n && e[i].handle == handle;i++) {
+			message[m].source = 0;
+			message[m].session = e[i].session;
+			message[m].data = NULL;
+			message[m].sz = (size_t)PTYPE_RESPONSE << MESSAGE_TYPE_SHIFT;
+			++m;
+		}
+		skynet_context_pushv(handle, message, m);
+	}
+}
+
+// returns the last node of the list
+static inline struct timer_node *
 dispatch_list(struct timer_node *current) {
+	struct expired e[TIMER_BATCH];
+	struct timer_node *last;
+	int n = 0;
 	do {
-		struct timer_event * event = (struct timer_event *)(current+1);
-		struct skynet_message message;
-		message.source = 0;
-		message.session = event->session;
-		message.data = NULL;
-		message.sz = (size_t)PTYPE_RESPONSE << MESSAGE_TYPE_SHIFT;
-
-		skynet_context_push(event->handle, &message);
-		
-		struct timer_node * temp = current;
+		e[n].handle = current->handle;
+		e[n].session = current->session;
+		e[n].index = n;
+		if (++n == TIMER_BATCH) {
+			dispatch_expired(e, n);
+			n = 0;
+		}
+		last = current;
 		current=current->next;
-		skynet_free(temp);	
 	} while (current);
+	dispatch_expired(e, n);
+	return last;
 }
 
 static inline void
-timer_execute(struct timer *T) {
-	int idx = T->time & TIME_NEAR_MASK;
+timer_execute(struct timer_wheel *W) {
+	int idx = W->time & TIME_NEAR_MASK;
 	
-	while (T->near[idx].head.next) {
-		struct timer_node *current = link_clear(&T->near[idx]);
-		SPIN_UNLOCK(T);
-		// dispatch_list don't need lock T
-		dispatch_list(current);
-		SPIN_LOCK(T);
+	while (!link_empty(&W->near[idx])) {
+		struct timer_node *current = link_clear(&W->near[idx]);
+		struct timer_node *n;
+		// they can't be cancelled after the lock is released
+		for (n=current;n;n=n->next) {
+			hash_remove(W, n->handle, n->session);
+		}
+		SPIN_UNLOCK(W);
+		// dispatch_list don't need lock W
+		struct timer_node *last = dispatch_list(current);
+		SPIN_LOCK(W);
+		node_free(W, current, last);
 	}
 }
 
 static void 
 timer_update(struct timer *T) {
-	SPIN_LOCK(T);
+	int i;
+	for (i=0;i<TIMER_SHARD;i++) {
+		struct timer_wheel *W = &T->shard[i];
+		SPIN_LOCK(W);
 
-	// try to dispatch timeout 0 (rare condition)
-	timer_execute(T);
+		// try to dispatch timeout 0 (rare condition)
+		timer_execute(W);
 
-	// shift time first, and then dispatch timer message
-	timer_shift(T);
+		// shift time first, and then dispatch timer message
+		timer_shift(W);
 
-	timer_execute(T);
+		timer_execute(W);
 
-	SPIN_UNLOCK(T);
+		SPIN_UNLOCK(W);
+	}
+	++T->time;
 }
 
-static struct timer *
-timer_create_timer() {
-	struct timer *r=(struct timer *)skynet_malloc(sizeof(struct timer));
-	memset(r,0,sizeof(*r));
-
+static void
+wheel_init(struct timer_wheel *W) {
 	int i,j;
 
 	for (i=0;i<TIME_NEAR;i++) {
-		link_clear(&r->near[i]);
+		link_init(&W->near[i]);
 	}
 
 	for (i=0;i<4;i++) {
 		for (j=0;j<TIME_LEVEL;j++) {
-			link_clear(&r->t[i][j]);
+			link_init(&W->t[i][j]);
 		}
 	}
 
-	SPIN_INIT(r)
+	SPIN_INIT(W)
+	W->time = 0;
+	W->freelist = NULL;
+	W->hash_size = TIMER_HASH_DEFAULT;
+	W->hash = skynet_malloc(W->hash_size * sizeof(struct timer_node *));
+	memset(W->hash, 0, W->hash_size * sizeof(struct timer_node *));
+	W->count = 0;
+}
+
+static struct timer *
+timer_create_timer() {
+	struct timer *r=(struct timer *)skynet_malloc(sizeof(struct timer));
+	memset(r,0,sizeof(*r));
+
+	int i;
+	for (i=0;i<TIMER_SHARD;i++) {
+		wheel_init(&r->shard[i]);
+	}
 
+	park_init(&r->sleep, TIMER_AWAKE);
+	ATOM_INIT(&r->wake, 0);
+	r->time = 0;
 	r->current = 0;
 
 	return r;
 }
 
-int
-skynet_timeout(uint32_t handle, int time, int session) {
+static int
+timeout_tick(uint32_t handle, int64_t time, int session) {
 	if (time <= 0) {
 		struct skynet_message message;
 		message.source = 0;
@@ -214,15 +431,31 @@ skynet_timeout(uint32_t handle, int time, int session) {
 			return -1;
 		}
 	} else {
-		struct timer_event event;
-		event.handle = handle;
-		event.session = session;
-		timer_add(TI, &event, sizeof(event), time);
+		timer_add(TI, handle, session, time < INT_MAX ? (int)time : INT_MAX);
 	}
 
 	return session;
 }
 
+// Remove the timer from the wheel, returns 1 if it's removed before it fires.
+int
+skynet_timeout_cancel(uint32_t handle, int session) {
+	return timer_cancel(TI, handle, session);
+}
+
+// time is in centisecond
+int
+skynet_timeout(uint32_t handle, int time, int session) {
+	return timeout_tick(handle, (int64_t)time * TI->tick_cs, session);
+}
+
+// time is in millisecond, it's rounded up to the tick of the wheel
+int
+skynet_timeout_ms(uint32_t handle, int time, int session) {
+	int tick_ms = TI->tick_usec / 1000;
+	return timeout_tick(handle, ((int64_t)time + tick_ms - 1) / tick_ms, session);
+}
+
 // centisecond: 1/100 second
 static void
 systime(uint32_t *sec, uint32_t *cs) {
@@ -232,13 +465,14 @@ systime(uint32_t *sec, uint32_t *cs) {
 	*cs = (uint32_t)(ti.tv_nsec / 10000000);
 }
 
+// in tick
 static uint64_t
 gettime() {
 	uint64_t t;
 	struct timespec ti;
 	clock_gettime(CLOCK_MONOTONIC, &ti);
-	t = (uint64_t)ti.tv_sec * 100;
-	t += ti.tv_nsec / 10000000;
+	t = (uint64_t)ti.tv_sec * 100 * TI->tick_cs;
+	t += ti.tv_nsec / (TI->tick_usec * 1000);
 	return t;
 }
 
@@ -266,18 +500,62 @@ skynet_starttime(void) {
 
 uint64_t 
 skynet_now(void) {
-	return TI->current;
+	return TI->current / TI->tick_cs;
 }
 
 void 
-skynet_timer_init(void) {
+skynet_timer_init(int precision) {
 	TI = timer_create_timer();
+	TI->tick_cs = (precision == 1) ? 10 : 1;
+	TI->tick_usec = 10000 / TI->tick_cs;
 	uint32_t current = 0;
 	systime(&TI->starttime, &current);
-	TI->current = current;
+	TI->current = (uint64_t)current * TI->tick_cs;
 	TI->current_point = gettime();
 }
 
+// The ticks before the next tick which has work : a timer expires, or the wheel cascades.
+static int
+next_expiry(struct timer *T) {
+	int offset = T->time & TIME_NEAR_MASK;
+	int d = TIME_NEAR - offset;
+	int i,j;
+	for (i=0;i<TIMER_SHARD;i++) {
+		struct timer_wheel *W = &T->shard[i];
+		SPIN_LOCK(W);
+		for (j=1;j<d;j++) {
+			if (!link_empty(&W->near[offset+j])) {
+				d = j;
+				break;
+			}
+		}
+		SPIN_UNLOCK(W);
+	}
+	return d;
+}
+
+// Sleep until the next expiry, at most max_usec. skynet_timeout wakes it up if it adds an earlier timer.
+void
+skynet_timer_wait(int max_usec) {
+	struct timer *T = TI;
+	// publish the sleep state before scanning the shards, so a timer added during the scan wakes it up.
+	ATOM_STORE(&T->wake, (int)(T->time + TIME_NEAR));
+	ATOM_STORE(&T->sleep.state, TIMER_SLEEP);
+	int d = next_expiry(T);
+	ATOM_STORE(&T->wake, (int)(T->time + d));
+
+	// T->time catches up current_point in skynet_updatetime
+	int64_t target = (int64_t)(T->current_point + d) * T->tick_usec;
+	int64_t usec = target - (int64_t)skynet_monotonic_time();
+	if (usec > max_usec) {
+		usec = max_usec;
+	}
+	if (usec > 0) {
+		park_wait_timeout(&T->sleep, TIMER_SLEEP, (int)usec);
+	}
+	ATOM_STORE(&T->sleep.state, TIMER_AWAKE);
+}
+
 // for profile
 
 #define NANOSEC 1000000000
@@ -290,3 +568,11 @@ skynet_thread_time(void) {
 
 	return (uint64_t)ti.tv_sec * MICROSEC + (uint64_t)ti.tv_nsec / (NANOSEC / MICROSEC);
 }
+
+uint64_t
+skynet_monotonic_time(void) {
+	struct timespec ti;
+	clock_gettime(CLOCK_MONOTONIC, &ti);
+
+	return (uint64_t)ti.tv_sec * MICROSEC + (uint64_t)ti.tv_nsec / (NANOSEC / MICROSEC);
+}
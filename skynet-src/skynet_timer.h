@@ -3,11 +3,17 @@
 
 #include <stdint.h>
 
-int skynet_timeout(uint32_t handle, int time, int session);
+int skynet_timeout(uint32_t handle, int time, int session);	// time is in centisecond
+int skynet_timeout_ms(uint32_t handle, int time, int session);	// time is in millisecond
+int skynet_timeout_cancel(uint32_t handle, int session);	// returns 1 if the timer is removed before it fires
 void skynet_updatetime(void);
 uint32_t skynet_starttime(void);
 uint64_t skynet_thread_time(void);	// for profile, in micro second
+uint64_t skynet_monotonic_time(void);	// for profile, in micro second
 
-void skynet_timer_init(void);
+// precision is the tick of the wheel in millisecond, 1 or 10
+void skynet_timer_init(int precision);
+// the timer thread sleeps until the next timer expires, at most max_usec
+void skynet_timer_wait(int max_usec);
 
 #endif
@@ -24,6 +24,7 @@ static void sp_nonblocking(int sock);
 
 #ifdef __linux__
 #include "socket_epoll.h"
+#include "socket_uring.h"
 #endif
 
 #if defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined (__NetBSD__)
@@ -1,12 +1,22 @@
+#ifdef __linux__
+#define _GNU_SOURCE	// sendmmsg
+#endif
+
 #include "skynet.h"
 
 #include "socket_server.h"
 #include "socket_poll.h"
+#include "skynet_readbuffer.h"
 #include "atomic.h"
 #include "spinlock.h"
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+#include <sched.h>
 #include <netinet/tcp.h>
 #include <unistd.h>
 #include <errno.h>
@@ -16,6 +26,7 @@
 #include <stdint.h>
 #include <assert.h>
 #include <string.h>
+#include <limits.h>
 
 #define MAX_INFO 128
 // MAX_SOCKET will be 2^MAX_SOCKET_P
@@ -50,6 +61,16 @@
 
 #define MAX_UDP_PACKAGE 65535
 
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+// max udp packages of one sendmmsg
+#define MAX_UDP_BATCH 64
+
+// ctrl commands in the queue, power of 2
+#define CTRL_QUEUE_SIZE 1024
+
 // EAGAIN and EWOULDBLOCK may be not the same value.
 #if (EAGAIN != EWOULDBLOCK)
 #define AGAIN_WOULDBLOCK EAGAIN : case EWOULDBLOCK
@@ -61,12 +82,38 @@
 
 #define USEROBJECT ((size_t)(-1))
 
+#ifdef SOCKET_URING
+#define URING_ENTRIES 256
+#define URING_BUFFER_COUNT 512
+#define URING_BUFFER_SIZE 8192
+#define URING_SEND_CHAIN 64
+#define URING_RECV_MERGE 64
+
+// The low 3 bits of io_uring user_data is the request type, the rest is the socket id (or the write_buffer of URING_SEND)
+#define URING_CTRL 0
+#define URING_IGNORE 1
+#define URING_POLLIN 2
+#define URING_POLLOUT 3
+#define URING_RECV 4
+#define URING_ACCEPT 5
+#define URING_SEND 6
+#define URING_TYPE 7
+
+// struct socket.armed
+#define ARMED_POLLIN 1
+#define ARMED_POLLOUT 2
+#define ARMED_RECV 4
+#define ARMED_ACCEPT 8
+#define ARMED_CANCEL 16
+#endif
+
 struct write_buffer {
 	struct write_buffer * next;
 	const void *buffer;
 	char *ptr;
 	size_t sz;
 	bool userobject;
+	int id;	// the socket of an io_uring send
 };
 
 struct write_buffer_udp {
@@ -110,24 +157,60 @@ struct socket {
 	int dw_offset;
 	const void * dw_buffer;
 	size_t dw_size;
+	// io_uring only
+	uint8_t armed;	// multishot or poll requests in flight, ARMED_*
+	bool dirty;	// in socket_server.dirty
+	int inflight;	// sends in flight
+};
+
+/*
+	The ctrl commands are sent by a bounded MPSC queue (each slot has a sequence number, as Vyukov's queue).
+	A sender writes the eventfd only when the flag notify is 0, so the commands sent before the socket thread
+	wakes up cost no syscall. The socket thread clears the flag when it reads the eventfd, and then drains the queue.
+ */
+struct ctrl_slot {
+	ATOM_SIZET seq;
+	uint8_t type;
+	uint8_t len;
+	uint8_t buffer[256];
+};
+
+struct ctrl_queue {
+	ATOM_SIZET tail;	// senders
+	size_t head;	// the socket thread
+	ATOM_INT notify;
+	struct ctrl_slot slot[CTRL_QUEUE_SIZE];
 };
 
 struct socket_server {
 	volatile uint64_t time;
 	int reserve_fd;	// for EMFILE
-	int recvctrl_fd;
-	int sendctrl_fd;
+	int recvctrl_fd;	// eventfd (or the read end of a pipe) to wake up the poll
+	int sendctrl_fd;	// the same eventfd (or the write end of the pipe)
 	int checkctrl;
 	poll_fd event_fd;
 	ATOM_INT alloc_id;
+	int id_mask;
+	int shard;	// the socket id of this shard is (n * shard_n + shard)
+	int shard_n;
+	int accept_shard;
+	struct socket_server **group;	// all the shards, indexed by shard
 	int event_n;
 	int event_index;
 	struct socket_object_interface soi;
+	struct uring *uring;	// NULL for sp_* (epoll or kqueue)
+	struct socket **dirty;	// the sockets which requests should be updated before waiting
+	int dirty_n;
+	int inflight;	// sends in flight of all the sockets
+	bool ctrl_armed;
+	struct spinlock handoff_lock;
+	struct accept_handoff *handoff_head;	// the accepted fds from other shards, see accept_fd
+	struct accept_handoff *handoff_tail;
 	struct event ev[MAX_EVENT];
 	struct socket slot[MAX_SOCKET];
 	char buffer[MAX_INFO];
 	uint8_t udpbuffer[MAX_UDP_PACKAGE];
-	fd_set rfds;
+	struct ctrl_queue ctrl;
 };
 
 struct request_open {
@@ -197,10 +280,22 @@ struct request_dial_udp {
 	uint8_t address[UDP_ADDRESS_SIZE];
 };
 
+struct request_accept {
+	int id;
+	int fd;
+	uintptr_t opaque;
+};
+
+struct accept_handoff {
+	struct accept_handoff *next;
+	struct request_accept req;
+};
+
 /*
 	The first byte is TYPE
 	R Resume socket
 	S Pause socket
+	Q Continue (resume) a paused socket quietly
 	B Bind socket
 	L Listen socket
 	K Close socket
@@ -214,10 +309,10 @@ struct request_dial_udp {
 	N client dial to UDP host port
 	T Set opt
 	U Create UDP socket
+	H Hand over a socket accepted by another shard
  */
 
 struct request_package {
-	uint8_t header[8];	// 6 bytes dummy
 	union {
 		char buffer[256];
 		struct request_open open;
@@ -288,6 +383,11 @@ socket_unlock(struct socket_lock *sl) {
 	}
 }
 
+static inline struct socket *
+socket_slot(struct socket_server *ss, int id) {
+	return &ss->slot[HASH_ID((unsigned)id / ss->shard_n)];
+}
+
 static inline int
 socket_invalid(struct socket *s, int id) {
 	return (s->id != id || ATOM_LOAD(&s->type) == SOCKET_TYPE_INVALID);
@@ -360,7 +460,8 @@ reserve_id(struct socket_server *ss) {
 		if (id < 0) {
 			id = ATOM_FAND(&(ss->alloc_id), 0x7fffffff) & 0x7fffffff;
 		}
-		struct socket *s = &ss->slot[HASH_ID(id)];
+		id = (id & ss->id_mask) * ss->shard_n + ss->shard;
+		struct socket *s = socket_slot(ss, id);
 		int type_invalid = ATOM_LOAD(&s->type);
 		if (type_invalid == SOCKET_TYPE_INVALID) {
 			if (ATOM_CAS(&s->type, type_invalid, SOCKET_TYPE_RESERVE)) {
@@ -386,8 +487,44 @@ clear_wb_list(struct wb_list *list) {
 	list->tail = NULL;
 }
 
+// fd[0] for reading and fd[1] for writing, they are the same eventfd on linux
+static int
+ctrl_open(int fd[2]) {
+#ifdef __linux__
+	int efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (efd < 0)
+		return 1;
+	fd[0] = fd[1] = efd;
+#else
+	if (pipe(fd))
+		return 1;
+	sp_nonblocking(fd[0]);
+	sp_nonblocking(fd[1]);
+#endif
+	return 0;
+}
+
+static void
+ctrl_close(struct socket_server *ss) {
+	close(ss->recvctrl_fd);
+	if (ss->sendctrl_fd != ss->recvctrl_fd) {
+		close(ss->sendctrl_fd);
+	}
+}
+
+static void
+ctrl_init(struct ctrl_queue *q) {
+	int i;
+	ATOM_INIT(&q->tail, 0);
+	q->head = 0;
+	ATOM_INIT(&q->notify, 0);
+	for (i=0;i<CTRL_QUEUE_SIZE;i++) {
+		ATOM_INIT(&q->slot[i].seq, i);
+	}
+}
+
 struct socket_server *
-socket_server_create(uint64_t time) {
+socket_server_create(uint64_t time, struct socket_server **group, int shard, int shard_n) {
 	int i;
 	int fd[2];
 	poll_fd efd = sp_create();
@@ -395,16 +532,18 @@ socket_server_create(uint64_t time) {
 		skynet_error(NULL, "socket-server error: create event pool failed.");
 		return NULL;
 	}
-	if (pipe(fd)) {
+	if (ctrl_open(fd)) {
 		sp_release(efd);
-		skynet_error(NULL, "socket-server error: create socket pair failed.");
+		skynet_error(NULL, "socket-server error: create ctrl fd failed.");
 		return NULL;
 	}
 	if (sp_add(efd, fd[0], NULL)) {
 		// add recvctrl_fd to event poll
 		skynet_error(NULL, "socket-server error: can't add server fd to event pool.");
 		close(fd[0]);
-		close(fd[1]);
+		if (fd[1] != fd[0]) {
+			close(fd[1]);
+		}
 		sp_release(efd);
 		return NULL;
 	}
@@ -415,6 +554,10 @@ socket_server_create(uint64_t time) {
 	ss->recvctrl_fd = fd[0];
 	ss->sendctrl_fd = fd[1];
 	ss->checkctrl = 1;
+	ctrl_init(&ss->ctrl);
+	spinlock_init(&ss->handoff_lock);
+	ss->handoff_head = NULL;
+	ss->handoff_tail = NULL;
 	ss->reserve_fd = dup(1);	// reserve an extra fd for EMFILE
 
 	for (i=0;i<MAX_SOCKET;i++) {
@@ -423,13 +566,28 @@ socket_server_create(uint64_t time) {
 		clear_wb_list(&s->high);
 		clear_wb_list(&s->low);
 		spinlock_init(&s->dw_lock);
+		s->armed = 0;
+		s->dirty = false;
+		s->inflight = 0;
 	}
 	ATOM_INIT(&ss->alloc_id , 0);
+	// keep n * shard_n + shard a positive int
+	ss->id_mask = 0x7fffffff;
+	while ((uint64_t)ss->id_mask * shard_n + shard > 0x7fffffff) {
+		ss->id_mask >>= 1;
+	}
+	ss->shard = shard;
+	ss->shard_n = shard_n;
+	ss->accept_shard = shard;
+	ss->group = group;
 	ss->event_n = 0;
 	ss->event_index = 0;
 	memset(&ss->soi, 0, sizeof(ss->soi));
-	FD_ZERO(&ss->rfds);
-	assert(ss->recvctrl_fd < FD_SETSIZE);
+	ss->uring = NULL;
+	ss->dirty = NULL;
+	ss->dirty_n = 0;
+	ss->inflight = 0;
+	ss->ctrl_armed = false;
 
 	return ss;
 }
@@ -500,8 +658,18 @@ force_close(struct socket_server *ss, struct socket *s, struct socket_lock *l, s
 	assert(type != SOCKET_TYPE_RESERVE);
 	free_wb_list(ss,&s->high);
 	free_wb_list(ss,&s->low);
-	sp_del(ss->event_fd, s->fd);
+	if (ss->uring == NULL) {
+		sp_del(ss->event_fd, s->fd);
+	}
 	socket_lock(l);
+#ifdef SOCKET_URING
+	if (ss->uring) {
+		// cancel the requests in flight before closing, the sends free their buffers when canceled.
+		// submit now, so the listen port is released at once as epoll does
+		su_close(ss->uring, s->fd, type != SOCKET_TYPE_BIND, URING_IGNORE);
+		su_submit(ss->uring, 0);
+	} else
+#endif
 	if (type != SOCKET_TYPE_BIND) {
 		if (close(s->fd) < 0) {
 			perror("close socket:");
@@ -520,6 +688,49 @@ force_close(struct socket_server *ss, struct socket *s, struct socket_lock *l, s
 	socket_unlock(l);
 }
 
+#ifdef SOCKET_URING
+// wait for the canceled sends to free their buffers
+static void
+uring_release(struct socket_server *ss) {
+	struct uring *u = ss->uring;
+	struct io_uring_cqe cqe;
+	while (ss->inflight > 0 && su_submit(u, 1) >= 0) {
+		while (su_cqe(u, &cqe)) {
+			if ((cqe.user_data & URING_TYPE) == URING_SEND) {
+				write_buffer_free(ss, (struct write_buffer *)(uintptr_t)(cqe.user_data & ~(uint64_t)URING_TYPE));
+				--ss->inflight;
+			}
+		}
+	}
+	su_release(u);
+	FREE(u);
+	FREE(ss->dirty);
+	ss->uring = NULL;
+}
+#endif
+
+int
+socket_server_uring(struct socket_server *ss) {
+#ifdef SOCKET_URING
+	struct uring *u = MALLOC(sizeof(*u));
+	if (su_create(u, URING_ENTRIES, URING_BUFFER_COUNT, URING_BUFFER_SIZE)) {
+		FREE(u);
+		return 1;
+	}
+	if (su_probe(u)) {
+		su_release(u);
+		FREE(u);
+		return 1;
+	}
+	ss->dirty = MALLOC(sizeof(struct socket *) * MAX_SOCKET);
+	ss->dirty_n = 0;
+	ss->uring = u;
+	return 0;
+#else
+	return 1;
+#endif
+}
+
 void
 socket_server_release(struct socket_server *ss) {
 	int i;
@@ -533,8 +744,20 @@ socket_server_release(struct socket_server *ss) {
 		}
 		spinlock_destroy(&s->dw_lock);
 	}
-	close(ss->sendctrl_fd);
-	close(ss->recvctrl_fd);
+	struct accept_handoff *h = ss->handoff_head;
+	while (h) {
+		struct accept_handoff *next = h->next;
+		close(h->req.fd);
+		FREE(h);
+		h = next;
+	}
+	spinlock_destroy(&ss->handoff_lock);
+#ifdef SOCKET_URING
+	if (ss->uring) {
+		uring_release(ss);
+	}
+#endif
+	ctrl_close(ss);
 	sp_release(ss->event_fd);
 	if (ss->reserve_fd >= 0)
 		close(ss->reserve_fd);
@@ -547,10 +770,23 @@ check_wb_list(struct wb_list *s) {
 	assert(s->tail == NULL);
 }
 
+// The requests of io_uring are updated in uring_arm() before waiting, the socket type may change before that.
+static inline void
+uring_dirty(struct socket_server *ss, struct socket *s) {
+	if (!s->dirty) {
+		s->dirty = true;
+		ss->dirty[ss->dirty_n++] = s;
+	}
+}
+
 static inline int
 enable_write(struct socket_server *ss, struct socket *s, bool enable) {
 	if (s->writing != enable) {
 		s->writing = enable;
+		if (ss->uring) {
+			uring_dirty(ss, s);
+			return 0;
+		}
 		return sp_enable(ss->event_fd, s->fd, s, s->reading, enable);
 	}
 	return 0;
@@ -560,6 +796,10 @@ static inline int
 enable_read(struct socket_server *ss, struct socket *s, bool enable) {
 	if (s->reading != enable) {
 		s->reading = enable;
+		if (ss->uring) {
+			uring_dirty(ss, s);
+			return 0;
+		}
 		return sp_enable(ss->event_fd, s->fd, s, enable, s->writing);
 	}
 	return 0;
@@ -567,10 +807,15 @@ enable_read(struct socket_server *ss, struct socket *s, bool enable) {
 
 static struct socket *
 new_fd(struct socket_server *ss, int id, int fd, int protocol, uintptr_t opaque, bool reading) {
-	struct socket * s = &ss->slot[HASH_ID(id)];
+	struct socket * s = socket_slot(ss, id);
 	assert(ATOM_LOAD(&s->type) == SOCKET_TYPE_RESERVE);
 
-	if (sp_add(ss->event_fd, fd, s)) {
+	if (ss->uring) {
+		// the requests of the last socket in this slot are canceled, and their completions are ignored by id
+		s->armed = 0;
+		s->inflight = 0;
+		uring_dirty(ss, s);
+	} else if (sp_add(ss->event_fd, fd, s)) {
 		ATOM_STORE(&s->type, SOCKET_TYPE_INVALID);
 		return NULL;
 	}
@@ -687,7 +932,7 @@ _failed:
 		close(sock);
 	freeaddrinfo( ai_list );
 _failed_getaddrinfo:
-	ATOM_STORE(&ss->slot[HASH_ID(id)].type, SOCKET_TYPE_INVALID);
+	ATOM_STORE(&socket_slot(ss, id)->type, SOCKET_TYPE_INVALID);
 	return SOCKET_ERR;
 }
 
@@ -723,12 +968,23 @@ close_write(struct socket_server *ss, struct socket *s, struct socket_lock *l, s
 	}
 }
 
+// write the list by writev, IOV_MAX buffers at a time
 static int
 send_list_tcp(struct socket_server *ss, struct socket *s, struct wb_list *list, struct socket_lock *l, struct socket_message *result) {
+	struct iovec iov[IOV_MAX];
 	while (list->head) {
-		struct write_buffer * tmp = list->head;
+		struct write_buffer * tmp;
+		int n = 0;
+		size_t total = 0;
+		for (tmp = list->head; tmp && n < IOV_MAX; tmp = tmp->next) {
+			iov[n].iov_base = tmp->ptr;
+			iov[n].iov_len = tmp->sz;
+			total += tmp->sz;
+			++n;
+		}
+		ssize_t sz;
 		for (;;) {
-			ssize_t sz = write(s->fd, tmp->ptr, tmp->sz);
+			sz = writev(s->fd, iov, n);
 			if (sz < 0) {
 				switch(errno) {
 				case EINTR:
@@ -738,17 +994,29 @@ send_list_tcp(struct socket_server *ss, struct socket *s, struct wb_list *list,
 				}
 				return close_write(ss, s, l, result);
 			}
-			stat_write(ss,s,(int)sz);
-			s->wb_size -= sz;
-			if (sz != tmp->sz) {
-				tmp->ptr += sz;
-				tmp->sz -= sz;
-				return -1;
-			}
 			break;
 		}
-		list->head = tmp->next;
-		write_buffer_free(ss,tmp);
+		stat_write(ss,s,(int)sz);
+		s->wb_size -= sz;
+		size_t left = sz;
+		while (list->head && left >= list->head->sz) {
+			tmp = list->head;
+			left -= tmp->sz;
+			list->head = tmp->next;
+			write_buffer_free(ss,tmp);
+		}
+		if (left > 0) {
+			// the head is sent partly, send_buffer_ raises it if it's in the low list
+			tmp = list->head;
+			tmp->ptr += left;
+			tmp->sz -= left;
+		}
+		if ((size_t)sz != total) {
+			if (list->head == NULL) {
+				list->tail = NULL;
+			}
+			return -1;
+		}
 	}
 	list->tail = NULL;
 
@@ -788,6 +1056,71 @@ drop_udp(struct socket_server *ss, struct socket *s, struct wb_list *list, struc
 	write_buffer_free(ss,tmp);
 }
 
+#ifdef __linux__
+
+// send the list by sendmmsg, MAX_UDP_BATCH packages at a time
+static int
+send_list_udp(struct socket_server *ss, struct socket *s, struct wb_list *list, struct socket_message *result) {
+	struct mmsghdr msg[MAX_UDP_BATCH];
+	struct iovec iov[MAX_UDP_BATCH];
+	union sockaddr_all sa[MAX_UDP_BATCH];
+	while (list->head) {
+		struct write_buffer * tmp;
+		int n = 0;
+		for (tmp = list->head; tmp && n < MAX_UDP_BATCH; tmp = tmp->next) {
+			struct write_buffer_udp * udp = (struct write_buffer_udp *)tmp;
+			socklen_t sasz = udp_socket_address(s, udp->udp_address, &sa[n]);
+			if (sasz == 0) {
+				break;
+			}
+			iov[n].iov_base = tmp->ptr;
+			iov[n].iov_len = tmp->sz;
+			memset(&msg[n], 0, sizeof(msg[n]));
+			msg[n].msg_hdr.msg_name = &sa[n];
+			msg[n].msg_hdr.msg_namelen = sasz;
+			msg[n].msg_hdr.msg_iov = &iov[n];
+			msg[n].msg_hdr.msg_iovlen = 1;
+			++n;
+		}
+		if (n == 0) {
+			skynet_error(NULL, "socket-server : udp (%d) error: type mismatch.", s->id);
+			drop_udp(ss, s, list, list->head);
+			return -1;
+		}
+		int sent = sendmmsg(s->fd, msg, n, 0);
+		if (sent < 0) {
+			switch(errno) {
+			case EINTR:
+			case AGAIN_WOULDBLOCK:
+				return -1;
+			}
+			skynet_error(NULL, "socket-server : udp (%d) sendmmsg error %s.",s->id, strerror(errno));
+			drop_udp(ss, s, list, list->head);
+			return -1;
+		}
+		int i;
+		for (i=0;i<sent;i++) {
+			tmp = list->head;
+			stat_write(ss,s,tmp->sz);
+			s->wb_size -= tmp->sz;
+			list->head = tmp->next;
+			write_buffer_free(ss,tmp);
+		}
+		if (sent < n) {
+			// the rest is sent later
+			if (list->head == NULL) {
+				list->tail = NULL;
+			}
+			return -1;
+		}
+	}
+	list->tail = NULL;
+
+	return -1;
+}
+
+#else
+
 static int
 send_list_udp(struct socket_server *ss, struct socket *s, struct wb_list *list, struct socket_message *result) {
 	while (list->head) {
@@ -821,6 +1154,8 @@ send_list_udp(struct socket_server *ss, struct socket *s, struct wb_list *list,
 	return -1;
 }
 
+#endif
+
 static int
 send_list(struct socket_server *ss, struct socket *s, struct wb_list *list, struct socket_lock *l, struct socket_message *result) {
 	if (s->protocol == PROTOCOL_TCP) {
@@ -858,7 +1193,7 @@ raise_uncomplete(struct socket * s) {
 
 static inline int
 send_buffer_empty(struct socket *s) {
-	return (s->high.head == NULL && s->low.head == NULL);
+	return (s->high.head == NULL && s->low.head == NULL && s->inflight == 0);
 }
 
 /*
@@ -930,12 +1265,10 @@ send_buffer_(struct socket_server *ss, struct socket *s, struct socket_lock *l,
 	return -1;
 }
 
-static int
-send_buffer(struct socket_server *ss, struct socket *s, struct socket_lock *l, struct socket_message *result) {
-	if (!socket_trylock(l))
-		return -1;	// blocked by direct write, send later.
+// add direct write buffer before high.head, call it with the socket lock
+static void
+append_direct_write(struct socket_server *ss, struct socket *s) {
 	if (s->dw_buffer) {
-		// add direct write buffer before high.head
 		struct write_buffer * buf = MALLOC(sizeof(*buf));
 		struct send_object so;
 		buf->userobject = send_object_init(ss, &so, (void *)s->dw_buffer, s->dw_size);
@@ -952,6 +1285,13 @@ send_buffer(struct socket_server *ss, struct socket *s, struct socket_lock *l, s
 		}
 		s->dw_buffer = NULL;
 	}
+}
+
+static int
+send_buffer(struct socket_server *ss, struct socket *s, struct socket_lock *l, struct socket_message *result) {
+	if (!socket_trylock(l))
+		return -1;	// blocked by direct write, send later.
+	append_direct_write(ss, s);
 	int r = send_buffer_(ss,s,l,result);
 	socket_unlock(l);
 
@@ -1001,7 +1341,7 @@ append_sendbuffer_low(struct socket_server *ss,struct socket *s, struct request_
 static int
 trigger_write(struct socket_server *ss, struct request_send * request, struct socket_message *result) {
 	int id = request->id;
-	struct socket * s = &ss->slot[HASH_ID(id)];
+	struct socket * s = socket_slot(ss, id);
 	if (socket_invalid(s, id))
 		return -1;
 	if (enable_write(ss, s, true)) {
@@ -1020,7 +1360,7 @@ trigger_write(struct socket_server *ss, struct request_send * request, struct so
 static int
 send_socket(struct socket_server *ss, struct request_send * request, struct socket_message *result, int priority, const uint8_t *udp_address) {
 	int id = request->id;
-	struct socket * s = &ss->slot[HASH_ID(id)];
+	struct socket * s = socket_slot(ss, id);
 	struct send_object so;
 	send_object_init(ss, &so, request->buffer, request->sz);
 	uint8_t type = ATOM_LOAD(&s->type);
@@ -1126,7 +1466,7 @@ _failed:
 	result->id = id;
 	result->ud = 0;
 	result->data = "reach skynet socket number limit";
-	ss->slot[HASH_ID(id)].type = SOCKET_TYPE_INVALID;
+	socket_slot(ss, id)->type = SOCKET_TYPE_INVALID;
 
 	return SOCKET_ERR;
 }
@@ -1162,7 +1502,7 @@ halfclose_read(struct socket *s) {
 static int
 close_socket(struct socket_server *ss, struct request_close *request, struct socket_message *result) {
 	int id = request->id;
-	struct socket * s = &ss->slot[HASH_ID(id)];
+	struct socket * s = socket_slot(ss, id);
 	if (socket_invalid(s, id)) {
 		// The socket is closed, ignore
 		return -1;
@@ -1212,7 +1552,7 @@ resume_socket(struct socket_server *ss, struct request_resumepause *request, str
 	result->opaque = request->opaque;
 	result->ud = 0;
 	result->data = NULL;
-	struct socket *s = &ss->slot[HASH_ID(id)];
+	struct socket *s = socket_slot(ss, id);
 	if (socket_invalid(s, id)) {
 		result->data = "invalid socket";
 		return SOCKET_ERR;
@@ -1247,7 +1587,7 @@ resume_socket(struct socket_server *ss, struct request_resumepause *request, str
 static int
 pause_socket(struct socket_server *ss, struct request_resumepause *request, struct socket_message *result) {
 	int id = request->id;
-	struct socket *s = &ss->slot[HASH_ID(id)];
+	struct socket *s = socket_slot(ss, id);
 	if (socket_invalid(s, id)) {
 		return -1;
 	}
@@ -1257,10 +1597,28 @@ pause_socket(struct socket_server *ss, struct request_resumepause *request, stru
 	return -1;
 }
 
+// resume a socket paused by socket_server_pause, without SOCKET_OPEN message
+static int
+continue_socket(struct socket_server *ss, struct request_resumepause *request, struct socket_message *result) {
+	int id = request->id;
+	struct socket *s = socket_slot(ss, id);
+	if (socket_invalid(s, id) || halfclose_read(s)) {
+		return -1;
+	}
+	uint8_t type = ATOM_LOAD(&s->type);
+	if (type != SOCKET_TYPE_CONNECTED) {
+		return -1;
+	}
+	if (enable_read(ss, s, true)) {
+		return report_error(s, result, "enable read failed");
+	}
+	return -1;
+}
+
 static void
 setopt_socket(struct socket_server *ss, struct request_setopt *request) {
 	int id = request->id;
-	struct socket *s = &ss->slot[HASH_ID(id)];
+	struct socket *s = socket_slot(ss, id);
 	if (socket_invalid(s, id)) {
 		return;
 	}
@@ -1268,34 +1626,36 @@ setopt_socket(struct socket_server *ss, struct request_setopt *request) {
 	setsockopt(s->fd, IPPROTO_TCP, request->what, &v, sizeof(v));
 }
 
-static void
-block_readpipe(int pipefd, void *buffer, int sz) {
-	for (;;) {
-		int n = read(pipefd, buffer, sz);
-		if (n<0) {
-			if (errno == EINTR)
-				continue;
-			skynet_error(NULL, "socket-server : read pipe error %s.",strerror(errno));
-			return;
-		}
-		// must atomic read from a pipe
-		assert(n == sz);
-		return;
-	}
-}
-
-static int
+// The command at head is published
+static inline int
 has_cmd(struct socket_server *ss) {
-	struct timeval tv = {0,0};
-	int retval;
+	struct ctrl_queue *q = &ss->ctrl;
+	return ATOM_LOAD(&q->slot[q->head & (CTRL_QUEUE_SIZE-1)].seq) == q->head + 1;
+}
 
-	FD_SET(ss->recvctrl_fd, &ss->rfds);
+// The ctrl fd is readable, clear it and check the queue again
+static void
+ctrl_wakeup(struct socket_server *ss) {
+	// eventfd reads 8 bytes, and the pipe has one byte for each notify
+	char tmp[64];
+	while (read(ss->recvctrl_fd, tmp, sizeof(tmp)) < 0 && errno == EINTR)
+		;
+	ATOM_STORE(&ss->ctrl.notify, 0);
+	ss->checkctrl = 1;
+}
 
-	retval = select(ss->recvctrl_fd+1, &ss->rfds, NULL, NULL, &tv);
-	if (retval == 1) {
-		return 1;
+static struct accept_handoff *
+handoff_pop(struct socket_server *ss) {
+	spinlock_lock(&ss->handoff_lock);
+	struct accept_handoff *h = ss->handoff_head;
+	if (h) {
+		ss->handoff_head = h->next;
+		if (h->next == NULL) {
+			ss->handoff_tail = NULL;
+		}
 	}
-	return 0;
+	spinlock_unlock(&ss->handoff_lock);
+	return h;
 }
 
 static void
@@ -1310,17 +1670,34 @@ add_udp_socket(struct socket_server *ss, struct request_udp *udp) {
 	struct socket *ns = new_fd(ss, id, udp->fd, protocol, udp->opaque, true);
 	if (ns == NULL) {
 		close(udp->fd);
-		ss->slot[HASH_ID(id)].type = SOCKET_TYPE_INVALID;
+		socket_slot(ss, id)->type = SOCKET_TYPE_INVALID;
 		return;
 	}
 	ATOM_STORE(&ns->type , SOCKET_TYPE_CONNECTED);
 	memset(ns->p.udp_address, 0, sizeof(ns->p.udp_address));
 }
 
+static int
+accept_socket(struct socket_server *ss, struct request_accept *request, struct socket_message *result) {
+	int id = request->id;
+	struct socket *ns = new_fd(ss, id, request->fd, PROTOCOL_TCP, request->opaque, false);
+	if (ns == NULL) {
+		close(request->fd);
+		// the owner has got the accept message of id
+		result->opaque = request->opaque;
+		result->id = id;
+		result->ud = 0;
+		result->data = "reach skynet socket number limit";
+		return SOCKET_ERR;
+	}
+	ATOM_STORE(&ns->type , SOCKET_TYPE_PACCEPT);
+	return -1;
+}
+
 static int
 set_udp_address(struct socket_server *ss, struct request_setudp *request, struct socket_message *result) {
 	int id = request->id;
-	struct socket *s = &ss->slot[HASH_ID(id)];
+	struct socket *s = socket_slot(ss, id);
 	if (socket_invalid(s, id)) {
 		return -1;
 	}
@@ -1346,7 +1723,7 @@ dial_udp_socket(struct socket_server *ss, struct request_dial_udp *request, stru
 	struct socket *ns = new_fd(ss, id, request->fd, protocol, request->opaque, true);
 	if (ns == NULL){
 		close(request->fd);
-		ss->slot[HASH_ID(id)].type = SOCKET_TYPE_INVALID;
+		socket_slot(ss, id)->type = SOCKET_TYPE_INVALID;
 		return -1;
 	}
 
@@ -1386,7 +1763,7 @@ inc_sending_ref(struct socket *s, int id) {
 
 static inline void
 dec_sending_ref(struct socket_server *ss, int id) {
-	struct socket * s = &ss->slot[HASH_ID(id)];
+	struct socket * s = socket_slot(ss, id);
 	// Notice: udp may inc sending while type == SOCKET_TYPE_RESERVE
 	if (s->id == id && s->protocol == PROTOCOL_TCP) {
 		assert((ATOM_LOAD(&s->sending) & 0xffff) != 0);
@@ -1397,20 +1774,24 @@ dec_sending_ref(struct socket_server *ss, int id) {
 // return type
 static int
 ctrl_cmd(struct socket_server *ss, struct socket_message *result) {
-	int fd = ss->recvctrl_fd;
+	struct ctrl_queue *q = &ss->ctrl;
+	struct ctrl_slot *slot = &q->slot[q->head & (CTRL_QUEUE_SIZE-1)];
 	// the length of message is one byte, so 256 buffer size is enough.
 	uint8_t buffer[256];
-	uint8_t header[2];
-	block_readpipe(fd, header, sizeof(header));
-	int type = header[0];
-	int len = header[1];
-	block_readpipe(fd, buffer, len);
+	int type = slot->type;
+	int len = slot->len;
+	memcpy(buffer, slot->buffer, len);
+	// release the slot for the senders
+	ATOM_STORE(&slot->seq, q->head + CTRL_QUEUE_SIZE);
+	++q->head;
 	// ctrl command only exist in local fd, so don't worry about endian.
 	switch (type) {
 	case 'R':
 		return resume_socket(ss,(struct request_resumepause *)buffer, result);
 	case 'S':
 		return pause_socket(ss,(struct request_resumepause *)buffer, result);
+	case 'Q':
+		return continue_socket(ss,(struct request_resumepause *)buffer, result);
 	case 'B':
 		return bind_socket(ss,(struct request_bind *)buffer, result);
 	case 'L':
@@ -1457,14 +1838,38 @@ ctrl_cmd(struct socket_server *ss, struct socket_message *result) {
 	return -1;
 }
 
+// recv 0
+static int
+close_by_remote(struct socket_server *ss, struct socket *s, struct socket_lock *l, struct socket_message * result) {
+	if (s->closing) {
+		// Rare case : if s->closing is true, reading event is disable, and SOCKET_CLOSE is raised.
+		if (nomore_sending_data(s)) {
+			force_close(ss,s,l,result);
+		}
+		return -1;
+	}
+	int t = ATOM_LOAD(&s->type);
+	if (t == SOCKET_TYPE_HALFCLOSE_READ) {
+		// Rare case : Already shutdown read.
+		return -1;
+	}
+	if (t == SOCKET_TYPE_HALFCLOSE_WRITE) {
+		// Remote shutdown read (write error) before.
+		force_close(ss,s,l,result);
+	} else {
+		close_read(ss, s, result);
+	}
+	return SOCKET_CLOSE;
+}
+
 // return -1 (ignore) when error
 static int
 forward_message_tcp(struct socket_server *ss, struct socket *s, struct socket_lock *l, struct socket_message * result) {
 	int sz = s->p.size;
-	char * buffer = MALLOC(sz);
+	char * buffer = skynet_readbuffer_alloc(sz);
 	int n = (int)read(s->fd, buffer, sz);
 	if (n<0) {
-		FREE(buffer);
+		skynet_readbuffer_free(buffer);
 		switch(errno) {
 		case EINTR:
 		case AGAIN_WOULDBLOCK:
@@ -1475,31 +1880,13 @@ forward_message_tcp(struct socket_server *ss, struct socket *s, struct socket_lo
 		return -1;
 	}
 	if (n==0) {
-		FREE(buffer);
-		if (s->closing) {
-			// Rare case : if s->closing is true, reading event is disable, and SOCKET_CLOSE is raised.
-			if (nomore_sending_data(s)) {
-				force_close(ss,s,l,result);
-			}
-			return -1;
-		}
-		int t = ATOM_LOAD(&s->type);
-		if (t == SOCKET_TYPE_HALFCLOSE_READ) {
-			// Rare case : Already shutdown read.
-			return -1;
-		}
-		if (t == SOCKET_TYPE_HALFCLOSE_WRITE) {
-			// Remote shutdown read (write error) before.
-			force_close(ss,s,l,result);
-		} else {
-			close_read(ss, s, result);
-		}
-		return SOCKET_CLOSE;
+		skynet_readbuffer_free(buffer);
+		return close_by_remote(ss, s, l, result);
 	}
 
 	if (halfclose_read(s)) {
 		// discard recv data (Rare case : if socket is HALFCLOSE_READ, reading event is disable.)
-		FREE(buffer);
+		skynet_readbuffer_free(buffer);
 		return -1;
 	}
 
@@ -1561,12 +1948,12 @@ forward_message_udp(struct socket_server *ss, struct socket *s, struct socket_lo
 	if (slen == sizeof(sa.v4)) {
 		if (s->protocol != PROTOCOL_UDP)
 			return -1;
-		data = MALLOC(n + 1 + 2 + 4);
+		data = skynet_readbuffer_alloc(n + 1 + 2 + 4);
 		gen_udp_address(PROTOCOL_UDP, &sa, data + n);
 	} else {
 		if (s->protocol != PROTOCOL_UDPv6)
 			return -1;
-		data = MALLOC(n + 1 + 2 + 16);
+		data = skynet_readbuffer_alloc(n + 1 + 2 + 16);
 		gen_udp_address(PROTOCOL_UDPv6, &sa, data + n);
 	}
 	memcpy(data, ss->udpbuffer, n);
@@ -1630,63 +2017,128 @@ getname(union sockaddr_all *u, char *buffer, size_t sz) {
 }
 
 // return 0 when failed, or -1 when file limit
+static void send_request(struct socket_server *ss, struct request_package *request, char type, int len);
+
 static int
-report_accept(struct socket_server *ss, struct socket *s, struct socket_message *result) {
+report_accept_limit(struct socket_server *ss, struct socket *s, struct socket_message *result, int err) {
 	union sockaddr_all u;
 	socklen_t len = sizeof(u);
-	int client_fd = accept(s->fd, &u.s, &len);
-	if (client_fd < 0) {
-		if (errno == EMFILE || errno == ENFILE) {
-			result->opaque = s->opaque;
-			result->id = s->id;
-			result->ud = 0;
-			result->data = strerror(errno);
+	result->opaque = s->opaque;
+	result->id = s->id;
+	result->ud = 0;
+	result->data = strerror(err);
 
-			// See https://stackoverflow.com/questions/47179793/how-to-gracefully-handle-accept-giving-emfile-and-close-the-connection
-			if (ss->reserve_fd >= 0) {
-				close(ss->reserve_fd);
-				client_fd = accept(s->fd, &u.s, &len);
-				if (client_fd >= 0) {
-					close(client_fd);
-				}
-				ss->reserve_fd = dup(1);
+	// See https://stackoverflow.com/questions/47179793/how-to-gracefully-handle-accept-giving-emfile-and-close-the-connection
+	if (ss->reserve_fd >= 0) {
+		close(ss->reserve_fd);
+		int client_fd = accept(s->fd, &u.s, &len);
+		if (client_fd >= 0) {
+			close(client_fd);
+		}
+		ss->reserve_fd = dup(1);
+	}
+	return -1;
+}
+
+// Wake up the socket thread of ss, it never blocks
+static void
+ctrl_notify(struct socket_server *ss) {
+	struct ctrl_queue *q = &ss->ctrl;
+	if (ATOM_LOAD(&q->notify) == 0 && ATOM_CAS(&q->notify, 0, 1)) {
+		// the first notify since the socket thread cleared the flag
+		for (;;) {
+#ifdef __linux__
+			uint64_t v = 1;
+			ssize_t n = write(ss->sendctrl_fd, &v, sizeof(v));
+#else
+			char v = 0;
+			ssize_t n = write(ss->sendctrl_fd, &v, sizeof(v));
+#endif
+			if (n < 0 && errno == EINTR) {
+				continue;
 			}
-			return -1;
-		} else {
-			return 0;
+			break;
 		}
 	}
-	int id = reserve_id(ss);
+}
+
+static void
+handoff_push(struct socket_server *ss, int id, int fd, uintptr_t opaque) {
+	struct accept_handoff *h = MALLOC(sizeof(*h));
+	h->next = NULL;
+	h->req.id = id;
+	h->req.fd = fd;
+	h->req.opaque = opaque;
+	spinlock_lock(&ss->handoff_lock);
+	if (ss->handoff_tail) {
+		ss->handoff_tail->next = h;
+	} else {
+		ss->handoff_head = h;
+	}
+	ss->handoff_tail = h;
+	spinlock_unlock(&ss->handoff_lock);
+	ctrl_notify(ss);
+}
+
+// client_fd is nonblocking, u is the address of the client (NULL if unknown)
+static int
+accept_fd(struct socket_server *ss, struct socket *s, int client_fd, union sockaddr_all *u, struct socket_message *result) {
+	// spread the connections across the shards
+	struct socket_server *target = ss->group ? ss->group[ss->accept_shard] : ss;
+	ss->accept_shard = (ss->accept_shard + 1) % ss->shard_n;
+	int id = reserve_id(target);
 	if (id < 0) {
 		close(client_fd);
 		return 0;
 	}
 	socket_keepalive(client_fd);
-	sp_nonblocking(client_fd);
-	struct socket *ns = new_fd(ss, id, client_fd, PROTOCOL_TCP, s->opaque, false);
-	if (ns == NULL) {
-		close(client_fd);
-		return 0;
+	if (target == ss) {
+		struct socket *ns = new_fd(ss, id, client_fd, PROTOCOL_TCP, s->opaque, false);
+		if (ns == NULL) {
+			close(client_fd);
+			return 0;
+		}
+		ATOM_STORE(&ns->type , SOCKET_TYPE_PACCEPT);
+	} else {
+		// not by the ctrl queue of target, it may be full and its socket thread may be sending to ours.
+		// the requests for this id go to the target after the hand over
+		handoff_push(target, id, client_fd, s->opaque);
 	}
 	// accept new one connection
 	stat_read(ss,s,1);
 
-	ATOM_STORE(&ns->type , SOCKET_TYPE_PACCEPT);
 	result->opaque = s->opaque;
 	result->id = s->id;
 	result->ud = id;
 	result->data = NULL;
 
-	if (getname(&u, ss->buffer, sizeof(ss->buffer))) {
+	if (u && getname(u, ss->buffer, sizeof(ss->buffer))) {
 		result->data = ss->buffer;
 	}
 
 	return 1;
 }
 
+static int
+report_accept(struct socket_server *ss, struct socket *s, struct socket_message *result) {
+	union sockaddr_all u;
+	socklen_t len = sizeof(u);
+	int client_fd = accept(s->fd, &u.s, &len);
+	if (client_fd < 0) {
+		if (errno == EMFILE || errno == ENFILE) {
+			return report_accept_limit(ss, s, result, errno);
+		} else {
+			return 0;
+		}
+	}
+	sp_nonblocking(client_fd);
+	return accept_fd(ss, s, client_fd, &u, result);
+}
+
 static inline void
 clear_closed_event(struct socket_server *ss, struct socket_message * result, int type) {
-	if (type == SOCKET_CLOSE || type == SOCKET_ERR) {
+	// the completions of io_uring are checked by id
+	if (ss->uring == NULL && (type == SOCKET_CLOSE || type == SOCKET_ERR)) {
 		int id = result->id;
 		int i;
 		for (i=ss->event_index; i<ss->event_n; i++) {
@@ -1702,12 +2154,357 @@ clear_closed_event(struct socket_server *ss, struct socket_message * result, int
 	}
 }
 
+#ifdef SOCKET_URING
+
+/*
+	io_uring mode
+
+	Listen sockets use multishot accept, tcp sockets use multishot recv with the provided buffers,
+	and the write buffer lists are sent by link chains of send (MSG_WAITALL), up to URING_SEND_CHAIN.
+	Others (connecting, udp, bind) use oneshot poll and the same handlers of epoll.
+	The requests are updated for the dirty sockets before waiting.
+ */
+
+static void
+uring_send(struct socket_server *ss, struct socket *s) {
+	struct write_buffer * chain[URING_SEND_CHAIN];
+	int n = 0;
+	struct socket_lock l;
+	socket_lock_init(s, &l);
+	socket_lock(&l);
+	append_direct_write(ss, s);
+	struct wb_list *list = &s->high;
+	while (n < URING_SEND_CHAIN) {
+		struct write_buffer *wb = list->head;
+		if (wb == NULL) {
+			if (list == &s->high) {
+				list = &s->low;
+				continue;
+			}
+			break;
+		}
+		list->head = wb->next;
+		if (list->head == NULL) {
+			list->tail = NULL;
+		}
+		chain[n++] = wb;
+	}
+	// direct write checks inflight with the lock
+	s->inflight = n;
+	socket_unlock(&l);
+	if (n == 0) {
+		s->writing = false;
+		return;
+	}
+	ss->inflight += n;
+	su_reserve(ss->uring, n);
+	int i;
+	for (i=0;i<n;i++) {
+		struct write_buffer *wb = chain[i];
+		wb->id = s->id;
+		su_send(ss->uring, s->fd, wb->ptr, wb->sz, i < n-1, (uint64_t)(uintptr_t)wb | URING_SEND);
+	}
+}
+
+static void
+uring_arm_socket(struct socket_server *ss, struct socket *s) {
+	struct uring *u = ss->uring;
+	int type = ATOM_LOAD(&s->type);
+	bool accept = false, recv = false, pollin = false, pollout = false, send = false;
+	switch (type) {
+	case SOCKET_TYPE_LISTEN:
+		accept = s->reading;
+		break;
+	case SOCKET_TYPE_CONNECTING:
+		pollout = true;
+		break;
+	case SOCKET_TYPE_BIND:
+		pollin = s->reading;
+		pollout = s->writing;
+		break;
+	case SOCKET_TYPE_CONNECTED:
+	case SOCKET_TYPE_HALFCLOSE_READ:
+	case SOCKET_TYPE_HALFCLOSE_WRITE:
+		if (s->protocol == PROTOCOL_TCP) {
+			recv = s->reading && type != SOCKET_TYPE_HALFCLOSE_READ;
+			send = s->writing && type != SOCKET_TYPE_HALFCLOSE_WRITE;
+		} else {
+			pollin = s->reading;
+			pollout = s->writing;
+		}
+		break;
+	default:
+		return;
+	}
+	uint64_t ud = (uint64_t)(unsigned)s->id << 3;
+	if (accept && !(s->armed & ARMED_ACCEPT)) {
+		su_accept_multishot(u, s->fd, ud | URING_ACCEPT);
+		s->armed |= ARMED_ACCEPT;
+	}
+	if (recv && !(s->armed & ARMED_RECV)) {
+		su_recv_multishot(u, s->fd, ud | URING_RECV);
+		s->armed |= ARMED_RECV;
+	}
+	if (!accept && !recv && (s->armed & (ARMED_ACCEPT | ARMED_RECV)) && !(s->armed & ARMED_CANCEL)) {
+		// paused, the multishot request is rearmed after it's canceled
+		su_cancel(u, ud | ((s->armed & ARMED_ACCEPT) ? URING_ACCEPT : URING_RECV), URING_IGNORE);
+		s->armed |= ARMED_CANCEL;
+	}
+	if (pollin && !(s->armed & ARMED_POLLIN)) {
+		su_poll(u, s->fd, POLLIN, ud | URING_POLLIN);
+		s->armed |= ARMED_POLLIN;
+	}
+	if (pollout && !(s->armed & ARMED_POLLOUT)) {
+		su_poll(u, s->fd, POLLOUT, ud | URING_POLLOUT);
+		s->armed |= ARMED_POLLOUT;
+	}
+	if (send && s->inflight == 0) {
+		uring_send(ss, s);
+	}
+}
+
+// returns the number of completions, or -1
+static int
+uring_wait(struct socket_server *ss) {
+	struct uring *u = ss->uring;
+	if (!ss->ctrl_armed) {
+		su_poll(u, ss->recvctrl_fd, POLLIN, URING_CTRL);
+		ss->ctrl_armed = true;
+	}
+	int i;
+	for (i=0;i<ss->dirty_n;i++) {
+		struct socket *s = ss->dirty[i];
+		s->dirty = false;
+		uring_arm_socket(ss, s);
+	}
+	ss->dirty_n = 0;
+	int n = su_ready(u);
+	if (su_submit(u, n == 0) < 0 && n == 0) {
+		return -1;
+	}
+	n = su_ready(u);
+	return n > MAX_EVENT ? MAX_EVENT : n;
+}
+
+static int
+uring_sent(struct socket_server *ss, struct write_buffer *wb, int res, struct socket_message *result) {
+	int id = wb->id;
+	size_t sz = wb->sz;
+	write_buffer_free(ss, wb);
+	--ss->inflight;
+	struct socket *s = socket_slot(ss, id);
+	if (socket_invalid(s, id)) {
+		// closed, the rest of the chain is canceled
+		return -1;
+	}
+	--s->inflight;
+	s->wb_size -= sz;
+	struct socket_lock l;
+	socket_lock_init(s, &l);
+	if (res < 0) {
+		errno = -res;
+		if (close_write(ss, s, &l, result) == SOCKET_ERR) {
+			// HALFCLOSE_WRITE
+			return SOCKET_ERR;
+		}
+		// SOCKET_RST (ignore)
+		return -1;
+	}
+	stat_write(ss,s,res);
+	if (s->inflight > 0) {
+		return -1;
+	}
+	if (!send_buffer_empty(s) || s->dw_buffer) {
+		// send the next chain
+		uring_dirty(ss, s);
+		return -1;
+	}
+	if (s->closing) {
+		// finish writing
+		force_close(ss, s, &l, result);
+		return -1;
+	}
+	enable_write(ss, s, false);
+	if (s->warn_size > 0) {
+		s->warn_size = 0;
+		result->opaque = s->opaque;
+		result->id = s->id;
+		result->ud = 0;
+		result->data = NULL;
+		return SOCKET_WARNING;
+	}
+	return -1;
+}
+
+static int
+uring_recv(struct socket_server *ss, struct socket *s, struct io_uring_cqe *cqe, struct socket_message *result) {
+	struct socket_lock l;
+	socket_lock_init(s, &l);
+	struct uring *u = ss->uring;
+	int n = cqe->res;
+	if (n > 0) {
+		unsigned short bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+		if (halfclose_read(s)) {
+			su_buffer_recycle(u, bid);
+			return -1;
+		}
+		// merge the following chunks of the same socket into one message
+		const struct io_uring_cqe *next;
+		int sz = n;
+		unsigned merge = 0;
+		while (merge < URING_RECV_MERGE && (next = su_peek(u, merge)) != NULL
+			&& next->user_data == cqe->user_data && next->res > 0 && (next->flags & IORING_CQE_F_MORE)) {
+			sz += next->res;
+			++merge;
+		}
+		char * buffer = skynet_readbuffer_alloc(sz);
+		memcpy(buffer, su_buffer(u, bid), n);
+		su_buffer_recycle(u, bid);
+		unsigned i;
+		int offset = n;
+		for (i=0;i<merge;i++) {
+			next = su_peek(u, i);
+			bid = next->flags >> IORING_CQE_BUFFER_SHIFT;
+			memcpy(buffer + offset, su_buffer(u, bid), next->res);
+			su_buffer_recycle(u, bid);
+			offset += next->res;
+		}
+		su_advance(u, merge);
+		n = sz;
+		stat_read(ss,s,n);
+		result->opaque = s->opaque;
+		result->id = s->id;
+		result->ud = n;
+		result->data = buffer;
+		return SOCKET_DATA;
+	}
+	if (n == 0) {
+		return close_by_remote(ss, s, &l, result);
+	}
+	switch (-n) {
+	case ENOBUFS:	// rearm later, the buffers are recycled
+	case ECANCELED:
+	case EINTR:
+	case EAGAIN:
+		return -1;
+	}
+	return report_error(s, result, strerror(-n));
+}
+
+// consume a completion
+static int
+uring_event(struct socket_server *ss, struct socket_message *result) {
+	struct io_uring_cqe cqe;
+	if (!su_cqe(ss->uring, &cqe)) {
+		return -1;
+	}
+	int type = cqe.user_data & URING_TYPE;
+	switch (type) {
+	case URING_CTRL:
+		ss->ctrl_armed = false;
+		ctrl_wakeup(ss);
+		return -1;
+	case URING_IGNORE:
+		return -1;
+	case URING_SEND:
+		return uring_sent(ss, (struct write_buffer *)(uintptr_t)(cqe.user_data & ~(uint64_t)URING_TYPE), cqe.res, result);
+	}
+	int id = (int)(cqe.user_data >> 3);
+	struct socket *s = socket_slot(ss, id);
+	if (socket_invalid(s, id)) {
+		// the socket is closed
+		if (cqe.flags & IORING_CQE_F_BUFFER) {
+			su_buffer_recycle(ss->uring, cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+		}
+		if (type == URING_ACCEPT && cqe.res >= 0) {
+			close(cqe.res);
+		}
+		return -1;
+	}
+	struct socket_lock l;
+	socket_lock_init(s, &l);
+	switch (type) {
+	case URING_RECV:
+		if (!(cqe.flags & IORING_CQE_F_MORE)) {
+			s->armed &= ~(ARMED_RECV | ARMED_CANCEL);
+			uring_dirty(ss, s);
+		}
+		return uring_recv(ss, s, &cqe, result);
+	case URING_ACCEPT:
+		if (!(cqe.flags & IORING_CQE_F_MORE)) {
+			s->armed &= ~(ARMED_ACCEPT | ARMED_CANCEL);
+			uring_dirty(ss, s);
+		}
+		if (cqe.res < 0) {
+			if (cqe.res == -EMFILE || cqe.res == -ENFILE) {
+				return report_accept_limit(ss, s, result, -cqe.res) < 0 ? SOCKET_ERR : -1;
+			}
+			return -1;
+		} else {
+			union sockaddr_all u;
+			socklen_t slen = sizeof(u);
+			int client_fd = cqe.res;
+			int ok = accept_fd(ss, s, client_fd, getpeername(client_fd, &u.s, &slen) == 0 ? &u : NULL, result);
+			return ok > 0 ? SOCKET_ACCEPT : -1;
+		}
+	case URING_POLLIN:
+		s->armed &= ~ARMED_POLLIN;
+		uring_dirty(ss, s);
+		if (!s->reading || cqe.res < 0) {
+			return -1;
+		}
+		if (s->protocol == PROTOCOL_TCP) {
+			type = forward_message_tcp(ss, s, &l, result);
+			// level triggered, poll again for more
+			return type == SOCKET_MORE ? SOCKET_DATA : type;
+		}
+		return forward_message_udp(ss, s, &l, result);
+	case URING_POLLOUT:
+		s->armed &= ~ARMED_POLLOUT;
+		uring_dirty(ss, s);
+		if (cqe.res < 0) {
+			return -1;
+		}
+		if (ATOM_LOAD(&s->type) == SOCKET_TYPE_CONNECTING) {
+			return report_connect(ss, s, &l, result);
+		}
+		if (!s->writing) {
+			return -1;
+		}
+		return send_buffer(ss, s, &l, result);
+	}
+	return -1;
+}
+
+#endif
+
+static inline int
+wait_event(struct socket_server *ss) {
+#ifdef SOCKET_URING
+	if (ss->uring) {
+		return uring_wait(ss);
+	}
+#endif
+	return sp_wait(ss->event_fd, ss->ev, MAX_EVENT);
+}
+
 // return type
 int
 socket_server_poll(struct socket_server *ss, struct socket_message * result, int * more) {
 	for (;;) {
 		if (ss->checkctrl) {
-			if (has_cmd(ss)) {
+			int cmd = has_cmd(ss);
+			// check the handoff after the queue, so an accepted fd is added before the commands of its id
+			struct accept_handoff *h = handoff_pop(ss);
+			if (h) {
+				int type = accept_socket(ss, &h->req, result);
+				FREE(h);
+				if (type != -1) {
+					clear_closed_event(ss, result, type);
+					return type;
+				} else
+					continue;
+			} else if (cmd) {
 				int type = ctrl_cmd(ss, result);
 				if (type != -1) {
 					clear_closed_event(ss, result, type);
@@ -1719,7 +2516,7 @@ socket_server_poll(struct socket_server *ss, struct socket_message * result, int
 			}
 		}
 		if (ss->event_index == ss->event_n) {
-			ss->event_n = sp_wait(ss->event_fd, ss->ev, MAX_EVENT);
+			ss->event_n = wait_event(ss);
 			ss->checkctrl = 1;
 			if (more) {
 				*more = 0;
@@ -1734,10 +2531,21 @@ socket_server_poll(struct socket_server *ss, struct socket_message * result, int
 				continue;
 			}
 		}
+#ifdef SOCKET_URING
+		if (ss->uring) {
+			++ss->event_index;
+			int type = uring_event(ss, result);
+			if (type != -1) {
+				return type;
+			}
+			continue;
+		}
+#endif
 		struct event *e = &ss->ev[ss->event_index++];
 		struct socket *s = e->s;
 		if (s == NULL) {
-			// dispatch pipe message at beginning
+			// dispatch ctrl commands at beginning
+			ctrl_wakeup(ss);
 			continue;
 		}
 		struct socket_lock l;
@@ -1820,20 +2628,26 @@ socket_server_poll(struct socket_server *ss, struct socket_message * result, int
 
 static void
 send_request(struct socket_server *ss, struct request_package *request, char type, int len) {
-	request->header[6] = (uint8_t)type;
-	request->header[7] = (uint8_t)len;
-	const char * req = (const char *)request + offsetof(struct request_package, header[6]);
+	struct ctrl_queue *q = &ss->ctrl;
+	struct ctrl_slot *slot;
 	for (;;) {
-		ssize_t n = write(ss->sendctrl_fd, req, len+2);
-		if (n<0) {
-			if (errno != EINTR) {
-				skynet_error(NULL, "socket-server : send ctrl command error %s.", strerror(errno));
+		size_t pos = ATOM_LOAD(&q->tail);
+		slot = &q->slot[pos & (CTRL_QUEUE_SIZE-1)];
+		size_t seq = ATOM_LOAD(&slot->seq);
+		if (seq == pos) {
+			if (ATOM_CAS_SIZET(&q->tail, pos, pos + 1)) {
+				slot->type = (uint8_t)type;
+				slot->len = (uint8_t)len;
+				memcpy(slot->buffer, &request->u, len);
+				ATOM_STORE(&slot->seq, pos + 1);
+				break;
 			}
-			continue;
+		} else if (seq < pos) {
+			// the queue is full, wait for the socket thread
+			sched_yield();
 		}
-		assert(n == len+2);
-		return;
 	}
+	ctrl_notify(ss);
 }
 
 static int
@@ -1880,7 +2694,7 @@ can_direct_write(struct socket *s, int id) {
 int
 socket_server_send(struct socket_server *ss, struct socket_sendbuffer *buf) {
 	int id = buf->id;
-	struct socket * s = &ss->slot[HASH_ID(id)];
+	struct socket * s = socket_slot(ss, id);
 	if (socket_invalid(s, id) || s->closing) {
 		free_buffer(ss, buf);
 		return -1;
@@ -1956,7 +2770,7 @@ int
 socket_server_send_lowpriority(struct socket_server *ss, struct socket_sendbuffer *buf) {
 	int id = buf->id;
 
-	struct socket * s = &ss->slot[HASH_ID(id)];
+	struct socket * s = socket_slot(ss, id);
 	if (socket_invalid(s, id)) {
 		free_buffer(ss, buf);
 		return -1;
@@ -2116,6 +2930,25 @@ socket_server_pause(struct socket_server *ss, uintptr_t opaque, int id) {
 	send_request(ss, &request, 'S', sizeof(request.u.resumepause));
 }
 
+// The socket thread can't send a request to its own ctrl queue, it may be full.
+void
+socket_server_pause_local(struct socket_server *ss, int id) {
+	struct socket *s = socket_slot(ss, id);
+	if (socket_invalid(s, id)) {
+		return;
+	}
+	enable_read(ss, s, false);
+}
+
+void
+socket_server_continue(struct socket_server *ss, uintptr_t opaque, int id) {
+	struct request_package request;
+	request_init(&request);
+	request.u.resumepause.id = id;
+	request.u.resumepause.opaque = opaque;
+	send_request(ss, &request, 'Q', sizeof(request.u.resumepause));
+}
+
 void
 socket_server_nodelay(struct socket_server *ss, int id) {
 	struct request_package request;
@@ -2259,7 +3092,7 @@ socket_server_udp_dial(struct socket_server *ss, uintptr_t opaque, const char* a
 int
 socket_server_udp_send(struct socket_server *ss, const struct socket_udp_address *addr, struct socket_sendbuffer *buf) {
 	int id = buf->id;
-	struct socket * s = &ss->slot[HASH_ID(id)];
+	struct socket * s = socket_slot(ss, id);
 	if (socket_invalid(s, id)) {
 		free_buffer(ss, buf);
 		return -1;
@@ -2321,7 +3154,7 @@ socket_server_udp_send(struct socket_server *ss, const struct socket_udp_address
 
 int
 socket_server_udp_connect(struct socket_server *ss, int id, const char * addr, int port) {
-	struct socket * s = &ss->slot[HASH_ID(id)];
+	struct socket * s = socket_slot(ss, id);
 	if (socket_invalid(s, id)) {
 		return -1;
 	}
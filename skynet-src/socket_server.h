@@ -27,8 +27,12 @@ struct socket_message {
 	char * data;
 };
 
-struct socket_server * socket_server_create(uint64_t time);
+// shard is the index of the server in group (shard_n servers), the ids it allocates are n * shard_n + shard.
+// The connections accepted by a shard are spread across the group.
+struct socket_server * socket_server_create(uint64_t time, struct socket_server **group, int shard, int shard_n);
 void socket_server_release(struct socket_server *);
+// use io_uring instead of epoll before any socket is created, return 0 when success
+int socket_server_uring(struct socket_server *);
 void socket_server_updatetime(struct socket_server *, uint64_t time);
 int socket_server_poll(struct socket_server *, struct socket_message *result, int *more);
 
@@ -37,6 +41,10 @@ void socket_server_close(struct socket_server *, uintptr_t opaque, int id);
 void socket_server_shutdown(struct socket_server *, uintptr_t opaque, int id);
 void socket_server_start(struct socket_server *, uintptr_t opaque, int id);
 void socket_server_pause(struct socket_server *, uintptr_t opaque, int id);
+// resume reading a paused socket, unlike socket_server_start it doesn't report SOCKET_OPEN
+void socket_server_continue(struct socket_server *, uintptr_t opaque, int id);
+// pause reading at once, only the socket thread of the server can call it (after socket_server_poll returns)
+void socket_server_pause_local(struct socket_server *, int id);
 
 // return -1 when error
 int socket_server_send(struct socket_server *, struct socket_sendbuffer *buffer);
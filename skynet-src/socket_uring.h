@@ -0,0 +1,344 @@
+#ifndef poll_socket_uring_h
+#define poll_socket_uring_h
+
+// The io_uring primitives for socket_server, without liburing.
+// SOCKET_URING is defined only if the kernel headers support multishot recv and provided buffer rings.
+
+#include <linux/io_uring.h>
+
+#if defined(IORING_RECV_MULTISHOT) && defined(IORING_ACCEPT_MULTISHOT) && defined(IORING_ASYNC_CANCEL_FD)
+
+#define SOCKET_URING
+
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+
+#define URING_BUFFER_GROUP 0
+
+struct uring {
+	int fd;
+	// submission queue
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_flags;
+	unsigned *sq_array;
+	unsigned sq_mask;
+	unsigned sq_entries;
+	unsigned sq_pending;	// sqes filled but not published
+	struct io_uring_sqe *sqes;
+	// completion queue
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned cq_mask;
+	struct io_uring_cqe *cqes;
+	void *ring;
+	size_t ring_sz;
+	size_t sqes_sz;
+	// provided buffers for recv
+	struct io_uring_buf_ring *br;
+	char *buffer;
+	unsigned buffer_count;
+	unsigned buffer_size;
+	unsigned short br_tail;
+	size_t br_sz;
+};
+
+static inline void
+su_buffer_recycle(struct uring *u, unsigned short bid) {
+	struct io_uring_buf *buf = &u->br->bufs[u->br_tail & (u->buffer_count - 1)];
+	buf->addr = (uint64_t)(uintptr_t)(u->buffer + (size_t)bid * u->buffer_size);
+	buf->len = u->buffer_size;
+	buf->bid = bid;
+	++u->br_tail;
+	__atomic_store_n(&u->br->tail, u->br_tail, __ATOMIC_RELEASE);
+}
+
+static inline const char *
+su_buffer(struct uring *u, unsigned short bid) {
+	return u->buffer + (size_t)bid * u->buffer_size;
+}
+
+static int
+su_buffer_init(struct uring *u, unsigned count, unsigned size) {
+	u->buffer_count = count;
+	u->buffer_size = size;
+	u->br_sz = count * sizeof(struct io_uring_buf);
+	void * br = mmap(NULL, u->br_sz, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+	if (br == MAP_FAILED) {
+		return 1;
+	}
+	u->br = br;
+	struct io_uring_buf_reg reg;
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (uint64_t)(uintptr_t)br;
+	reg.ring_entries = count;
+	reg.bgid = URING_BUFFER_GROUP;
+	if (syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+		munmap(br, u->br_sz);
+		u->br = NULL;
+		return 1;
+	}
+	u->buffer = malloc((size_t)count * size);
+	if (u->buffer == NULL) {
+		return 1;
+	}
+	u->br_tail = 0;
+	unsigned i;
+	for (i=0;i<count;i++) {
+		su_buffer_recycle(u, (unsigned short)i);
+	}
+	return 0;
+}
+
+static void
+su_release(struct uring *u) {
+	if (u->fd >= 0)
+		close(u->fd);
+	if (u->ring)
+		munmap(u->ring, u->ring_sz);
+	if (u->sqes)
+		munmap(u->sqes, u->sqes_sz);
+	if (u->br)
+		munmap(u->br, u->br_sz);
+	free(u->buffer);
+	memset(u, 0, sizeof(*u));
+	u->fd = -1;
+}
+
+// count and size of the provided buffers must be power of 2
+static int
+su_create(struct uring *u, unsigned entries, unsigned buffer_count, unsigned buffer_size) {
+	memset(u, 0, sizeof(*u));
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	p.flags = IORING_SETUP_CQSIZE;
+	p.cq_entries = entries * 16;
+	u->fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (u->fd < 0 || !(p.features & IORING_FEAT_SINGLE_MMAP)) {
+		su_release(u);
+		return 1;
+	}
+	size_t sq_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	size_t cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	u->ring_sz = sq_sz > cq_sz ? sq_sz : cq_sz;
+	u->ring = mmap(NULL, u->ring_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+	if (u->ring == MAP_FAILED) {
+		u->ring = NULL;
+		su_release(u);
+		return 1;
+	}
+	u->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+	u->sqes = mmap(NULL, u->sqes_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+	if (u->sqes == MAP_FAILED) {
+		u->sqes = NULL;
+		su_release(u);
+		return 1;
+	}
+	char * ring = u->ring;
+	u->sq_head = (unsigned *)(ring + p.sq_off.head);
+	u->sq_tail = (unsigned *)(ring + p.sq_off.tail);
+	u->sq_flags = (unsigned *)(ring + p.sq_off.flags);
+	u->sq_array = (unsigned *)(ring + p.sq_off.array);
+	u->sq_mask = *(unsigned *)(ring + p.sq_off.ring_mask);
+	u->sq_entries = p.sq_entries;
+	u->cq_head = (unsigned *)(ring + p.cq_off.head);
+	u->cq_tail = (unsigned *)(ring + p.cq_off.tail);
+	u->cq_mask = *(unsigned *)(ring + p.cq_off.ring_mask);
+	u->cqes = (struct io_uring_cqe *)(ring + p.cq_off.cqes);
+	if (su_buffer_init(u, buffer_count, buffer_size)) {
+		su_release(u);
+		return 1;
+	}
+	return 0;
+}
+
+// submit the pending sqes, and wait for one cqe at least if wait
+static int
+su_submit(struct uring *u, int wait) {
+	unsigned n = u->sq_pending;
+	unsigned tail = *u->sq_tail;
+	unsigned i;
+	for (i=0;i<n;i++) {
+		u->sq_array[(tail + i) & u->sq_mask] = (tail + i) & u->sq_mask;
+	}
+	__atomic_store_n(u->sq_tail, tail + n, __ATOMIC_RELEASE);
+	u->sq_pending = 0;
+	for (;;) {
+		int r = syscall(__NR_io_uring_enter, u->fd, n, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+		if (r >= 0 || errno != EINTR || n == 0) {
+			return r;
+		}
+		// the sqes may be consumed partly, submit the rest
+		n = *u->sq_tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+		wait = 0;
+	}
+}
+
+// a cleared sqe, submit first if the queue is full
+static struct io_uring_sqe *
+su_sqe(struct uring *u) {
+	unsigned tail = *u->sq_tail + u->sq_pending;
+	if (tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) >= u->sq_entries) {
+		su_submit(u, 0);
+		tail = *u->sq_tail;
+	}
+	struct io_uring_sqe *sqe = &u->sqes[tail & u->sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+	++u->sq_pending;
+	return sqe;
+}
+
+// at least n free sqes, for a link chain which must be submitted at once
+static void
+su_reserve(struct uring *u, unsigned n) {
+	if (*u->sq_tail + u->sq_pending + n - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) > u->sq_entries) {
+		su_submit(u, 0);
+	}
+}
+
+static inline int
+su_ready(struct uring *u) {
+	return __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE) - *u->cq_head;
+}
+
+// the nth ready cqe without consuming it, or NULL
+static inline const struct io_uring_cqe *
+su_peek(struct uring *u, unsigned n) {
+	unsigned head = *u->cq_head;
+	if (__atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE) - head <= n) {
+		return NULL;
+	}
+	return &u->cqes[(head + n) & u->cq_mask];
+}
+
+// consume n cqes
+static inline void
+su_advance(struct uring *u, unsigned n) {
+	__atomic_store_n(u->cq_head, *u->cq_head + n, __ATOMIC_RELEASE);
+}
+
+// copy the first cqe out and consume it, return 0 if the completion queue is empty
+static inline int
+su_cqe(struct uring *u, struct io_uring_cqe *cqe) {
+	unsigned head = *u->cq_head;
+	if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) {
+		return 0;
+	}
+	*cqe = u->cqes[head & u->cq_mask];
+	__atomic_store_n(u->cq_head, head + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+static inline void
+su_poll(struct uring *u, int fd, unsigned events, uint64_t ud) {
+	struct io_uring_sqe *sqe = su_sqe(u);
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll32_events = events;
+	sqe->user_data = ud;
+}
+
+static inline void
+su_recv_multishot(struct uring *u, int fd, uint64_t ud) {
+	struct io_uring_sqe *sqe = su_sqe(u);
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = fd;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = URING_BUFFER_GROUP;
+	sqe->user_data = ud;
+}
+
+static inline void
+su_accept_multishot(struct uring *u, int fd, uint64_t ud) {
+	struct io_uring_sqe *sqe = su_sqe(u);
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = fd;
+	sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+	sqe->accept_flags = SOCK_NONBLOCK;
+	sqe->user_data = ud;
+}
+
+// MSG_WAITALL makes a short send fail, so the rest of a link chain is canceled
+static inline void
+su_send(struct uring *u, int fd, const void *buffer, size_t sz, int link, uint64_t ud) {
+	struct io_uring_sqe *sqe = su_sqe(u);
+	sqe->opcode = IORING_OP_SEND;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t)(uintptr_t)buffer;
+	sqe->len = (unsigned)sz;
+	sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+	sqe->flags = link ? IOSQE_IO_LINK : 0;
+	sqe->user_data = ud;
+}
+
+static inline void
+su_cancel(struct uring *u, uint64_t target, uint64_t ud) {
+	struct io_uring_sqe *sqe = su_sqe(u);
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = target;
+	sqe->user_data = ud;
+}
+
+// cancel all the requests of fd, and then close it if close_fd
+static inline void
+su_close(struct uring *u, int fd, int close_fd, uint64_t ud) {
+	su_reserve(u, 2);
+	struct io_uring_sqe *sqe = su_sqe(u);
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = fd;
+	sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+	sqe->user_data = ud;
+	if (close_fd) {
+		// hard link : close even if there is nothing to cancel
+		sqe->flags = IOSQE_IO_HARDLINK;
+		sqe = su_sqe(u);
+		sqe->opcode = IORING_OP_CLOSE;
+		sqe->fd = fd;
+		sqe->user_data = ud;
+	}
+}
+
+// Check multishot recv with provided buffers works (Linux 6.0+), the caller falls back to epoll if not.
+static int
+su_probe(struct uring *u) {
+	int fd[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fd)) {
+		return 1;
+	}
+	su_recv_multishot(u, fd[0], 1);
+	int ok = 0;
+	if (su_submit(u, 0) >= 0 && write(fd[1], "x", 1) == 1 && su_submit(u, 1) >= 0) {
+		struct io_uring_cqe cqe;
+		if (su_cqe(u, &cqe) && cqe.user_data == 1 && cqe.res == 1
+			&& (cqe.flags & IORING_CQE_F_BUFFER) && (cqe.flags & IORING_CQE_F_MORE)) {
+			ok = 1;
+			su_buffer_recycle(u, (unsigned short)(cqe.flags >> IORING_CQE_BUFFER_SHIFT));
+		}
+	}
+	su_close(u, fd[0], 1, 2);
+	close(fd[1]);
+	// wait for the cancel and the close
+	struct io_uring_cqe cqe;
+	int n = 0;
+	while (n < 2 && su_submit(u, 1) >= 0) {
+		while (su_cqe(u, &cqe)) {
+			if (cqe.user_data == 2) {
+				++n;
+			}
+		}
+	}
+	return !ok;
+}
+
+#endif
+
+#endif
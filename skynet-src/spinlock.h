@@ -135,4 +135,8 @@ spinlock_destroy(struct spinlock *lock) {
 
 #endif
 
+#ifndef atomic_pause_
+#define atomic_pause_() ((void)0)
+#endif
+
 #endif
@@ -0,0 +1,17 @@
+#ifndef SKYNET_STRHASH_H
+#define SKYNET_STRHASH_H
+
+#include <stdint.h>
+
+// FNV-1a, for the hash tables of names and env keys
+static inline uint32_t
+strhash(const char *str) {
+	uint32_t h = 2166136261u;
+	const unsigned char *p;
+	for (p = (const unsigned char *)str; *p; p++) {
+		h = (h ^ *p) * 16777619u;
+	}
+	return h;
+}
+
+#endif
@@ -0,0 +1,56 @@
+local skynet = require "skynet"
+
+-- a cancelled timer must send no message, or it comes as an unknown response
+local unknown = 0
+skynet.dispatch_unknown_response(function(session)
+	print("unknown response", session)
+	unknown = unknown + 1
+end)
+
+local function test_cancel()
+	local fired = {}
+	local sessions = {}
+	for i=1,10 do
+		local _, session = skynet.timeout(i * 5, function() fired[i] = true end)
+		sessions[i] = session
+	end
+	-- cancel the odd ones
+	for i=1,10,2 do
+		assert(skynet.canceltimeout(sessions[i]))
+	end
+	-- cancel twice
+	assert(not skynet.canceltimeout(sessions[1]))
+	skynet.sleep(100)
+	for i=1,10 do
+		print("timeout", i, fired[i])
+		assert((fired[i] == true) == (i % 2 == 0))
+	end
+	-- the timer has fired
+	assert(not skynet.canceltimeout(sessions[2]))
+	assert(skynet.task() == 0)
+	assert(unknown == 0)
+end
+
+local function test_wakeup()
+	local co = coroutine.running()
+	skynet.fork(function()
+		skynet.wakeup(co)
+	end)
+	local t = skynet.now()
+	skynet.sleep(1000)
+	print("wakeup after", skynet.now() - t)
+	assert(skynet.now() - t < 1000)
+	assert(skynet.task() == 0)
+	skynet.sleep(1100)
+	assert(unknown == 0)
+end
+
+skynet.start(function()
+	test_cancel()
+	skynet.trace_timeout(true)
+	test_cancel()
+	skynet.trace_timeout(false)
+	test_wakeup()
+	print("Test canceltimeout done")
+	skynet.exit()
+end)
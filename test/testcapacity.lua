@@ -0,0 +1,132 @@
+local skynet = require "skynet"
+require "skynet.manager"	-- import skynet.capacity
+local socket = require "skynet.socket"
+
+local mode, capacity, policy = ...
+
+local PORT = 18890
+
+if mode == "slave" then
+
+local handled = 0
+local received = 0
+local closed = false
+
+local CMD = {}
+
+-- block the worker, the messages sent meanwhile stay in the mailbox
+function CMD.busy(ti)
+	local t = skynet.now() + ti
+	while skynet.now() < t do end
+end
+
+function CMD.ping()
+	handled = handled + 1
+end
+
+function CMD.stat()
+	skynet.ret(skynet.pack(handled, skynet.stat "dropped", received, closed))
+end
+
+function CMD.listen()
+	local lid = socket.listen("127.0.0.1", PORT)
+	socket.start(lid, function(id)
+		socket.close(lid)
+		socket.start(id)
+		while true do
+			local s = socket.read(id)
+			if not s then
+				break
+			end
+			received = received + #s
+		end
+		socket.close(id)
+		closed = true
+	end)
+	skynet.ret()
+end
+
+skynet.start(function()
+	skynet.capacity(tonumber(capacity), policy)
+	skynet.dispatch("lua", function(_,_, cmd, ...)
+		local f = CMD[cmd]
+		f(...)
+	end)
+end)
+
+else
+
+local N = 100
+
+-- the call is rejected when the mailbox is full, retry it
+local function stat(slave)
+	while true do
+		local ok, handled, dropped, received, closed = pcall(skynet.call, slave, "lua", "stat")
+		if ok then
+			return handled, dropped, received, closed
+		end
+		skynet.sleep(1)
+	end
+end
+
+local function test_policy(policy)
+	local slave = skynet.newservice(SERVICE_NAME, "slave", 10, policy)
+	skynet.send(slave, "lua", "busy", 50)
+	skynet.sleep(10)
+	local failed = 0
+	for i = 1, N do
+		if not skynet.send(slave, "lua", "ping") then
+			failed = failed + 1
+		end
+	end
+	assert(not pcall(skynet.call, slave, "lua", "stat"), "call to a full mailbox must fail")
+	-- wait for the slave to drain the mailbox, or the stat call may be refused
+	skynet.sleep(60)
+	local handled, dropped = skynet.call(slave, "lua", "stat")
+	skynet.error(string.format("policy %s : %d handled, %d refused, %d failed sends", policy, handled, dropped, failed))
+	assert(handled > 0 and handled < N)
+	if policy == "drop" then
+		assert(failed == 0)
+		-- the rejected call is counted too
+		assert(handled + dropped == N + 1)
+	else
+		assert(handled + failed == N)
+		assert(dropped == failed + 1)
+	end
+	skynet.kill(slave)
+end
+
+-- the socket thread pauses the socket instead of dropping the data, and resumes it after the mailbox drains
+local function test_socket()
+	local slave = skynet.newservice(SERVICE_NAME, "slave", 4, "reject")
+	skynet.call(slave, "lua", "listen")
+	local fd = assert(socket.open("127.0.0.1", PORT))
+	skynet.send(slave, "lua", "busy", 50)
+	local block = string.rep("x", 4096)
+	local total = 0
+	for i = 1, 1024 do
+		socket.write(fd, block)
+		total = total + #block
+	end
+	socket.close(fd)
+	while true do
+		local _, _, received, closed = stat(slave)
+		if closed then
+			skynet.error(string.format("socket : %d bytes sent, %d bytes received", total, received))
+			assert(received == total)
+			break
+		end
+		skynet.sleep(10)
+	end
+	skynet.kill(slave)
+end
+
+skynet.start(function()
+	test_policy "reject"
+	test_policy "drop"
+	test_socket()
+	skynet.error("Test capacity done")
+	skynet.exit()
+end)
+
+end
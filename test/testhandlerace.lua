@@ -0,0 +1,97 @@
+local skynet = require "skynet"
+require "skynet.manager"	-- import skynet.name and skynet.kill
+
+-- The readers look up the names and call the services, while the master creates, names and kills them.
+-- Run it with thread > 1, so the handle lookups race with the retirements.
+
+local mode = ...
+
+local ROUND = 500
+local READER = 4
+
+if mode == "slave" then
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_,_, cmd)
+		assert(cmd == "ping")
+		skynet.ret(skynet.pack(skynet.self()))
+	end)
+end)
+
+elseif mode == "reader" then
+
+local current = 0
+local running = true
+
+local function read()
+	local ok, fail, miss = 0, 0, 0
+	while running do
+		local name = ".race" .. current
+		local addr = skynet.localname(name)
+		if addr then
+			local succ, ret = pcall(skynet.call, addr, "lua", "ping")
+			if succ then
+				-- the handle never points to another service
+				assert(ret == addr)
+				ok = ok + 1
+			else
+				fail = fail + 1
+			end
+			-- the service may have exited
+			skynet.send(addr, "lua", "ping")
+		else
+			miss = miss + 1
+		end
+		skynet.yield()
+	end
+	return ok, fail, miss
+end
+
+skynet.start(function()
+	local result
+	skynet.dispatch("lua", function(_,_, cmd, n)
+		if cmd == "current" then
+			current = n
+		elseif cmd == "stop" then
+			running = false
+			while not result do
+				skynet.yield()
+			end
+			skynet.ret(skynet.pack(table.unpack(result)))
+		end
+	end)
+	skynet.fork(function()
+		result = table.pack(read())
+	end)
+end)
+
+else
+
+skynet.start(function()
+	local readers = {}
+	for i=1,READER do
+		readers[i] = skynet.newservice(SERVICE_NAME, "reader")
+	end
+	for i=1,ROUND do
+		local addr = skynet.newservice(SERVICE_NAME, "slave")
+		local name = ".race" .. i
+		skynet.name(name, addr)
+		assert(skynet.localname(name) == addr)
+		assert(skynet.resolvename(name) == addr)
+		for _, r in ipairs(readers) do
+			skynet.send(r, "lua", "current", i)
+		end
+		skynet.sleep(1)
+		skynet.kill(addr)
+		assert(skynet.localname(name) == nil, "the name is removed with the service")
+		assert(skynet.resolvename(name) == nil, "the cached handle is dropped")
+	end
+	for i, r in ipairs(readers) do
+		local ok, fail, miss = skynet.call(r, "lua", "stop")
+		skynet.error(string.format("reader %d : %d calls, %d failed, %d names missed", i, ok, fail, miss))
+		skynet.kill(r)
+	end
+	skynet.error("Test handle race done")
+end)
+
+end
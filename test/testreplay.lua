@@ -0,0 +1,78 @@
+local skynet = require "skynet"
+require "skynet.manager"	-- import skynet.kill
+local core = require "skynet.core"
+
+-- Capture a service which calls another one, and replay the capture to a new instance.
+-- It needs logpath in config, the capture file is written there.
+
+local mode, arg1, arg2 = ...
+
+local N = 100
+
+if mode == "echo" then
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_,_, ...)
+		skynet.ret(skynet.pack(...))
+	end)
+end)
+
+elseif mode == "caller" then
+
+local echo = tonumber(arg1)
+local observer = tonumber(arg2)
+
+skynet.start(function()
+	-- the replayed instance must get no response it didn't ask for
+	skynet.dispatch_unknown_response(function(session)
+		skynet.send(observer, "lua", "unknown", session)
+	end)
+	skynet.dispatch("lua", function(_,_, i)
+		-- before the call, replay kills the new instance when it answers PING, maybe during the call
+		skynet.send(observer, "lua", "handled", i)
+		local r = skynet.call(echo, "lua", i)
+		assert(r == i)
+		skynet.ret(skynet.pack(r))
+	end)
+end)
+
+else
+
+skynet.start(function()
+	local handled, unknown = 0, 0
+	skynet.dispatch("lua", function(_,_, cmd)
+		if cmd == "handled" then
+			handled = handled + 1
+		elseif cmd == "unknown" then
+			unknown = unknown + 1
+		end
+	end)
+	local logpath = assert(skynet.getenv "logpath", "set logpath in config")
+	local echo = skynet.newservice(SERVICE_NAME, "echo")
+	local caller = skynet.newservice(SERVICE_NAME, "caller", echo, skynet.self())
+	core.command("LOGON", skynet.address(caller) .. " binary")
+	for i=1,N do
+		assert(skynet.call(caller, "lua", i) == i)
+	end
+	-- LOGOFF from another service closes the capture before the next message of caller
+	core.command("LOGOFF", skynet.address(caller))
+	skynet.call(caller, "debug", "PING")
+	skynet.kill(caller)
+	assert(handled == N)
+
+	local filename = string.format("%s/%08x.cap", logpath, caller)
+	skynet.newservice("replay", filename, 0, SERVICE_NAME, "caller", echo, skynet.self())
+	for i=1,100 do
+		if handled == N * 2 then
+			break
+		end
+		skynet.sleep(10)
+	end
+	skynet.error(string.format("replayed %d requests, %d unknown responses", handled - N, unknown))
+	assert(handled == N * 2)
+	assert(unknown == 0)
+	skynet.kill(echo)
+	skynet.error("Test replay done")
+end)
+
+end
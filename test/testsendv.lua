@@ -0,0 +1,68 @@
+local skynet = require "skynet"
+require "skynet.manager"	-- import skynet.kill
+
+local mode = ...
+
+if mode == "slave" then
+
+local count = 0
+local sources = {}
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_, source, cmd, ...)
+		if cmd == "msg" then
+			local a, b = ...
+			assert(a == "hello" and b.n == 42)
+			count = count + 1
+			sources[source] = (sources[source] or 0) + 1
+		elseif cmd == "count" then
+			skynet.ret(skynet.pack(count, sources))
+		end
+	end)
+end)
+
+else
+
+local SLAVE = 8
+
+skynet.start(function()
+	local slaves = {}
+	for i=1,SLAVE do
+		slaves[i] = skynet.newservice(SERVICE_NAME, "slave")
+	end
+	local dead = skynet.newservice(SERVICE_NAME, "slave")
+	skynet.kill(dead)
+
+	-- runs of the same address and more addresses than a batch of skynet_send_batch
+	local addrs = {}
+	local expect = {}
+	for i=1,200 do
+		local s = slaves[(i // 3) % SLAVE + 1]
+		addrs[i] = s
+		expect[s] = (expect[s] or 0) + 1
+	end
+	table.insert(addrs, 100, dead)
+	local sent = skynet.sendv(addrs, "lua", "msg", "hello", { n = 42 })
+	print("sendv", #addrs, "sent", sent)
+	assert(sent == 200)
+
+	-- an invalid address fails before any message is sent, and the packed message is freed
+	assert(not pcall(skynet.sendv, { slaves[1], 0 }, "lua", "msg", "hello", { n = 42 }))
+
+	-- redirectv keeps the source
+	local source = slaves[1]
+	local r = skynet.redirectv(slaves, source, "lua", 0, skynet.pack("msg", "hello", { n = 42 }))
+	assert(r == SLAVE)
+
+	for i, s in ipairs(slaves) do
+		local count, sources = skynet.call(s, "lua", "count")
+		print("slave", i, count)
+		assert(count == expect[s] + 1)
+		assert(sources[skynet.self()] == expect[s])
+		assert(sources[source] == 1)
+		skynet.kill(s)
+	end
+	print("Test sendv done")
+end)
+
+end
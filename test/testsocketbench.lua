@@ -0,0 +1,55 @@
+-- Loopback echo benchmark for the socket threads.
+-- skynet config with start = "testsocketbench" ; or skynet.newservice("testsocketbench", clients, rounds, size)
+-- Run it with socket_uring = true and false to compare the backends,
+-- and `strace -c -f -p <pid>` during the run counts the syscalls per message.
+
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+
+local clients, rounds, size = ...
+clients = tonumber(clients) or 100
+rounds = tonumber(rounds) or 1000
+size = tonumber(size) or 64
+
+local PORT = 18889
+
+local function echo(id)
+	socket.start(id)
+	while true do
+		local s = socket.read(id)
+		if not s then
+			socket.close(id)
+			return
+		end
+		socket.write(id, s)
+	end
+end
+
+skynet.start(function()
+	local lid = socket.listen("127.0.0.1", PORT)
+	socket.start(lid, function(id)
+		skynet.fork(echo, id)
+	end)
+	local msg = string.rep("x", size)
+	local done = 0
+	local start = skynet.now()
+	for i=1,clients do
+		skynet.fork(function()
+			local c = assert(socket.open("127.0.0.1", PORT))
+			for j=1,rounds do
+				socket.write(c, msg)
+				assert(socket.read(c, size) == msg)
+			end
+			socket.close(c)
+			done = done + 1
+		end)
+	end
+	while done < clients do
+		skynet.sleep(10)
+	end
+	local cost = (skynet.now() - start) / 100
+	local n = clients * rounds
+	print(string.format("%d clients, %d round trips of %d bytes in %.2fs, %.0f msgs/s, %.1f MB/s",
+		clients, n, size, cost, n / cost, n * size * 2 / cost / 1024 / 1024))
+	socket.close(lid)
+end)
@@ -0,0 +1,199 @@
+// Decode the binary message capture files written by skynet (logformat = "binary").
+// usage: capdump [-x] file.cap ...
+// -x dumps the whole payload in hex, or only the first HEX_LIMIT bytes are shown.
+
+#include "skynet_capture.h"
+#include "lua-seri.h"
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+// keep in sync with skynet.h
+#define PTYPE_TEXT 0
+#define PTYPE_RESPONSE 1
+#define PTYPE_SOCKET 6
+#define PTYPE_ERROR 7
+#define PTYPE_LUA 10
+
+#define HEX_LIMIT 64
+
+static const char * dump_source = "\n\
+local function dump(v, depth)\n\
+	local t = type(v)\n\
+	if t == 'string' then\n\
+		return string.format('%q', v)\n\
+	elseif t ~= 'table' then\n\
+		return tostring(v)\n\
+	elseif depth > 3 then\n\
+		return '{...}'\n\
+	end\n\
+	local items = {}\n\
+	for k, value in pairs(v) do\n\
+		items[#items+1] = '[' .. dump(k, depth+1) .. ']=' .. dump(value, depth+1)\n\
+	end\n\
+	return '{' .. table.concat(items, ',') .. '}'\n\
+end\n\
+return function(...)\n\
+	local n = select('#', ...)\n\
+	local r = {}\n\
+	for i = 1, n do\n\
+		r[i] = dump((select(i, ...)), 0)\n\
+	end\n\
+	return table.concat(r, ' ')\n\
+end\n\
+";
+
+static int hex_all = 0;
+
+static void
+dump_hex(const uint8_t *data, size_t sz) {
+	size_t n = sz;
+	if (!hex_all && n > HEX_LIMIT) {
+		n = HEX_LIMIT;
+	}
+	size_t i;
+	for (i=0;i<n;i++) {
+		printf("%02x", data[i]);
+	}
+	if (n < sz) {
+		printf("...");
+	}
+}
+
+static int
+lunpack(lua_State *L) {
+	lua_pushcfunction(L, luaseri_unpack);
+	lua_pushvalue(L, 1);
+	lua_pushvalue(L, 2);
+	lua_call(L, 2, LUA_MULTRET);
+	int n = lua_gettop(L) - 2;
+	lua_pushvalue(L, lua_upvalueindex(1));
+	lua_insert(L, 3);
+	lua_call(L, n, 1);
+	return 1;
+}
+
+// returns 0 if the payload isn't packed by skynet.pack
+static int
+dump_lua(lua_State *L, const void *data, size_t sz) {
+	lua_pushvalue(L, 1);	// lunpack
+	lua_pushlightuserdata(L, (void *)data);
+	lua_pushinteger(L, (lua_Integer)sz);
+	if (lua_pcall(L, 2, 1, 0) != LUA_OK) {
+		lua_pop(L, 1);
+		return 0;
+	}
+	printf("%s", lua_tostring(L, -1));
+	lua_pop(L, 1);
+	return 1;
+}
+
+static void
+dump_record(lua_State *L, const struct skynet_capture_header *h, const struct skynet_capture_record *rec) {
+	const uint8_t *payload = (const uint8_t *)(rec + 1);
+	size_t size = rec->size;
+	printf("%.6f :%08x %d %d %u ", (double)(rec->time - h->open_time) / 1000000.0, rec->source, rec->type, rec->session, rec->sz);
+	switch (rec->type) {
+	case PTYPE_TEXT:
+	case PTYPE_ERROR:
+		printf("[%.*s]", (int)size, (const char *)payload);
+		break;
+	case PTYPE_SOCKET:
+		if (size >= sizeof(struct skynet_capture_socket)) {
+			const struct skynet_capture_socket *s = (const struct skynet_capture_socket *)payload;
+			printf("[socket] %d %d %d ", s->type, s->id, s->ud);
+			dump_hex(payload + sizeof(*s), size - sizeof(*s));
+		}
+		break;
+	case PTYPE_RESPONSE:
+	case PTYPE_LUA:
+		if (size == rec->sz && dump_lua(L, payload, size)) {
+			break;
+		}
+		// fall through
+	default:
+		dump_hex(payload, size);
+		break;
+	}
+	if (size < rec->sz) {
+		printf(" (truncated)");
+	}
+	printf("\n");
+}
+
+static int
+dump_file(lua_State *L, const char *filename) {
+	FILE *f = fopen(filename, "rb");
+	if (f == NULL) {
+		fprintf(stderr, "Can't open %s\n", filename);
+		return 1;
+	}
+	char header[SKYNET_CAPTURE_HEADER];
+	struct skynet_capture_header *h = (struct skynet_capture_header *)header;
+	if (fread(header, sizeof(header), 1, f) != 1 || memcmp(h->magic, SKYNET_CAPTURE_MAGIC, sizeof(h->magic)) != 0) {
+		fprintf(stderr, "%s is not a capture file\n", filename);
+		fclose(f);
+		return 1;
+	}
+	uint64_t cap = h->capacity;
+	char *ring = malloc(cap);
+	if (ring == NULL || fread(ring, cap, 1, f) != 1) {
+		fprintf(stderr, "%s is truncated\n", filename);
+		free(ring);
+		fclose(f);
+		return 1;
+	}
+	fclose(f);
+	printf("# handle :%08x, %" PRIu64 " bytes, %" PRIu64 " bytes overwritten\n", h->handle, h->head - h->tail, h->tail);
+	uint64_t pos = h->tail;
+	while (pos < h->head) {
+		uint64_t offset = pos % cap;
+		uint64_t rest = cap - offset;
+		const struct skynet_capture_record *rec = (const struct skynet_capture_record *)(ring + offset);
+		if (rest < sizeof(*rec) || rec->size == SKYNET_CAPTURE_WRAP) {
+			pos += rest;
+			continue;
+		}
+		if (skynet_capture_recordsize(rec->size) > rest) {
+			fprintf(stderr, "%s is corrupted at %" PRIu64 "\n", filename, pos);
+			break;
+		}
+		dump_record(L, h, rec);
+		pos += skynet_capture_recordsize(rec->size);
+	}
+	free(ring);
+	return 0;
+}
+
+int
+main(int argc, char *argv[]) {
+	int i = 1;
+	if (i < argc && strcmp(argv[i], "-x") == 0) {
+		hex_all = 1;
+		++i;
+	}
+	if (i >= argc) {
+		fprintf(stderr, "usage: %s [-x] file.cap ...\n", argv[0]);
+		return 1;
+	}
+	lua_State *L = luaL_newstate();
+	luaL_openlibs(L);
+	if (luaL_loadstring(L, dump_source) != LUA_OK || lua_pcall(L, 0, 1, 0) != LUA_OK) {
+		fprintf(stderr, "%s\n", lua_tostring(L, -1));
+		return 1;
+	}
+	lua_pushcclosure(L, lunpack, 1);
+	int err = 0;
+	for (;i<argc;i++) {
+		err |= dump_file(L, argv[i]);
+	}
+	lua_close(L);
+	return err;
+}